@@ -1,7 +1,14 @@
 fn main() {
-    cc::Build::new()
+    let mut build = cc::Build::new();
+    build
         .cpp(true)
         .file("cc/AudioInterface.cc")
         .file("cc/AudioPlayer.cc")
-        .compile("libezaudio.a");
+        .file("cc/MixKernels.cc")
+        .file("cc/RtAudit.cc");
+    // real time safety audit build, see cc/RtAudit.h
+    if std::env::var("CARGO_FEATURE_RT_AUDIT").is_ok() {
+        build.define("EZAUDIO_RT_AUDIT", None);
+    }
+    build.compile("libezaudio.a");
 }
@@ -1,168 +1,1355 @@
 #include "AudioInterface.h"
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* path, bool) {
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file); //the mapping keeps the file alive
+	if(mapping == NULL) {
+		return false;
+	}
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); //the view keeps the mapping alive
+	if(data == nullptr) {
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+	if(data != nullptr) {
+		UnmapViewOfFile((void*)data);
+		data = nullptr;
+		size = 0;
+	}
+}
+
+#else
+
+bool MappedFile::open(const char* path, bool sequential) {
+	int fd = ::open(path, O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+	void* mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file alive
+	if(mapped == MAP_FAILED) {
+		return false;
+	}
+	madvise(mapped, (size_t)st.st_size, sequential ? MADV_SEQUENTIAL : MADV_WILLNEED);
+	data = mapped;
+	size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if(data != nullptr) {
+		munmap((void*)data, size);
+		data = nullptr;
+		size = 0;
+	}
+}
+
+#endif
+
+//default for AudioContext::streamThreshold, files bigger than this stream
+//through a decode thread instead of being decoded up front into the cache
+static const size_t defaultStreamThreshold = 4 * 1024 * 1024;
+
+static long fileSize(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) {
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+//drains a decoder into a PcmBuffer
+static PcmBuffer* decodeAll(ma_decoder* decoder, ma_uint32 channels, ma_uint32 sampleRate) {
+	PcmBuffer* buffer = new PcmBuffer;
+	buffer->channels = channels;
+	buffer->sampleRate = sampleRate;
+	buffer->refs.store(0, std::memory_order_relaxed);
+	buffer->cached = false;
+	buffer->frameCount = 0;
+
+	const ma_uint64 chunkFrames = 16384;
+	for(;;) {
+		buffer->frames.resize((buffer->frameCount + chunkFrames) * channels);
+		ma_uint64 framesRead = ma_decoder_read_pcm_frames(decoder, buffer->frames.data() + buffer->frameCount * channels, chunkFrames);
+		buffer->frameCount += framesRead;
+		if(framesRead < chunkFrames) {
+			break;
+		}
+	}
+	buffer->frames.resize(buffer->frameCount * channels);
+	buffer->frames.shrink_to_fit();
+	return buffer;
+}
+
+//decodes a whole file into a PcmBuffer at its native rate, the voice brings
+//it to the device rate at mix time so one cached decode serves every output
+static PcmBuffer* decodeFile(const char* path, ma_uint32 channels) {
+	ma_decoder decoder;
+	ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, channels, 0); //0 keeps the native rate
+	MappedFile map;
+	if(map.open(path, true)) {
+		if(ma_decoder_init_memory(map.data, map.size, &decoderConfig, &decoder) != MA_SUCCESS) {
+			map.close();
+			return nullptr;
+		}
+	} else if(ma_decoder_init_file(path, &decoderConfig, &decoder) != MA_SUCCESS) {
+		return nullptr;
+	}
+
+	PcmBuffer* buffer = decodeAll(&decoder, channels, decoder.outputSampleRate);
+	ma_decoder_uninit(&decoder);
+	map.close();
+	return buffer;
+}
+
+//advances on every cache touch, ordered because it only moves under cacheMtx
+static uint64_t cacheClock = 0;
+
+//caller must hold cacheMtx, drops the least recently used unreferenced
+//buffers until the decoded bytes fit the budget, buffers a voice still holds
+//are never touched so going over budget with everything playing just means
+//the cache shrinks later, eviction only ever costs a future re-decode
+static void evictCache(AudioContext* context) {
+	if(context->cacheBudget == 0) {
+		return;
+	}
+	size_t usage = 0;
+	for(auto& entry : *context->cache) {
+		usage += entry.second->frames.size() * sizeof(float);
+	}
+	while(usage > context->cacheBudget) {
+		PcmBuffer* oldest = nullptr;
+		for(auto& entry : *context->cache) {
+			if(entry.second->refs.load(std::memory_order_acquire) == 0
+				&& (oldest == nullptr || entry.second->lastUsed < oldest->lastUsed)) {
+				oldest = entry.second;
+			}
+		}
+		if(oldest == nullptr) {
+			break; //every buffer left is in use
+		}
+		usage -= oldest->frames.size() * sizeof(float);
+		context->cache->erase(oldest->key);
+		delete oldest;
+	}
+}
+
+//decodes a file once per (path, channels) and hands out refcounted shared buffers
+static PcmBuffer* acquireBuffer(AudioContext* context, const char* path, ma_uint32 channels) {
+	std::string key = std::string(path) + "@" + std::to_string(channels);
+	{
+		LockGuard lock(*context->cacheMtx);
+		auto it = context->cache->find(key);
+		if(it != context->cache->end()) {
+			it->second->refs.fetch_add(1, std::memory_order_relaxed);
+			it->second->lastUsed = ++cacheClock;
+			return it->second;
+		}
+	}
+
+	//decode outside the lock so a slow file does not stall every other load
+	PcmBuffer* buffer = decodeFile(path, channels);
+	if(buffer == nullptr) {
+		return nullptr;
+	}
+	buffer->key = key;
+
+	LockGuard lock(*context->cacheMtx);
+	auto it = context->cache->find(key);
+	if(it != context->cache->end()) {
+		//another load raced us to the same file, keep the winner
+		delete buffer;
+		it->second->refs.fetch_add(1, std::memory_order_relaxed);
+		it->second->lastUsed = ++cacheClock;
+		return it->second;
+	}
+	buffer->refs.store(1, std::memory_order_relaxed);
+	buffer->cached = true;
+	buffer->lastUsed = ++cacheClock;
+	context->cache->insert({key, buffer});
+	evictCache(context); //the new buffer holds a ref so it cannot evict itself
+	return buffer;
+}
+
+static void releaseBuffer(AudioContext* context, PcmBuffer* buffer) {
+	//the cache keeps its unreferenced buffers alive so reloads stay cheap,
+	//private buffers from memory loads are freed with their last clip
+	if(buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		if(!buffer->cached) {
+			delete buffer;
+		} else if(context->cacheBudget != 0) {
+			//the buffer just became evictable, trim if we are over budget
+			LockGuard lock(*context->cacheMtx);
+			evictCache(context);
+		}
+	}
+}
+
+//finds the OutputDevice for a physical output, opening it on first use
+static OutputDevice* getOutput(AudioContext* context, AudioDevice* device) {
+	LockGuard lock(*context->mtx);
+	for(OutputDevice* output : *context->outputs) {
+		if(std::memcmp(&output->deviceId, &device->id, sizeof(ma_device_id)) == 0) {
+			return output;
+		}
+	}
+
+	OutputDevice* output = new OutputDevice;
+	output->context = context;
+	output->deviceId = device->id;
+
+	output->deviceConfig = ma_device_config_init(ma_device_type_playback);
+	output->deviceConfig.playback.format    = ma_format_f32;
+	output->deviceConfig.playback.channels  = 2;
+	output->deviceConfig.sampleRate         = 0; //use the native rate of the output
+	output->deviceConfig.dataCallback       = data_callback;
+	output->deviceConfig.pUserData          = output;
+	output->deviceConfig.playback.pDeviceID = &output->deviceId;
+
+	if(ma_device_init(context->context, &output->deviceConfig, &output->device) != MA_SUCCESS) {
+		std::cout << "Failed to open playback device" << std::endl;
+		delete output;
+		return nullptr;
+	}
+
+	//sized to the period the backend actually chose so the resize guard in the
+	//callback never fires and the callback stays allocation free
+	ma_uint32 scratchFrames = output->device.playback.internalPeriodSizeInFrames;
+	if(scratchFrames < 8192) {
+		scratchFrames = 8192;
+	}
+	output->scratch.resize((size_t)scratchFrames * output->device.playback.channels);
+	output->clips.reserve(256); //so attach in the callback does not allocate
+	output->commands.init(256);
+	output->stats.init();
+	context->outputs->push_back(output);
+	return output;
+}
+
+static void loadLoop(LoadWorker* worker);
+
+//control plane helpers, all structural changes to a running output go through
+//its command queue so the callback never has to take a lock
+
+static void pushCommand(OutputDevice* output, const Command& command) {
+	while(!output->commands.push(command)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+//callers must hold context->mtx so the started check cannot race a play()
+static void attachClip(OutputDevice* output, SoundClip* clip) {
+	if(ma_device_is_started(&output->device)) {
+		pushCommand(output, Command{commandAttach, clip, 0, 0, false, nullptr});
+	} else {
+		output->clips.push_back(clip);
+	}
+}
+
+static void detachClip(OutputDevice* output, SoundClip* clip) {
+	if(ma_device_is_started(&output->device)) {
+		clip->detached.store(false, std::memory_order_relaxed);
+		pushCommand(output, Command{commandDetach, clip, 0, 0, false, nullptr});
+		while(!clip->detached.load(std::memory_order_acquire)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	} else {
+		output->clips.erase(std::remove(output->clips.begin(), output->clips.end(), clip), output->clips.end());
+		for(SoundClip* other : output->clips) {
+			if(other->nextClip == clip) {
+				other->nextClip = nullptr;
+			}
+		}
+	}
+}
+
+static void seekClip(OutputDevice* output, SoundClip* clip, ma_uint64 frame) {
+	//clamp to the clip so a seek past the end can't leave the cursor beyond
+	//frameCount, renderBuffer would underflow framesLeft and read off the heap
+	if(clip->streaming) {
+		if(clip->streamFrames != 0 && frame > clip->streamFrames) {
+			frame = clip->streamFrames;
+		}
+		//the decode thread owns the decoder, hand the seek to it
+		clip->cursor.store(frame, std::memory_order_relaxed);
+		clip->seekTarget.store(frame, std::memory_order_relaxed);
+		clip->seekRequest.store(true, std::memory_order_release);
+	} else if(ma_device_is_started(&output->device)) {
+		if(frame > clip->buffer->frameCount) {
+			frame = clip->buffer->frameCount;
+		}
+		pushCommand(output, Command{commandSeek, clip, frame, 0, false, nullptr});
+	} else {
+		if(frame > clip->buffer->frameCount) {
+			frame = clip->buffer->frameCount;
+		}
+		clip->cursor.store(frame, std::memory_order_relaxed);
+		clip->srcPos = (double)frame;
+	}
+}
 
 extern "C" AudioContext init(void (*end_callback)(void*)) {
-	std::lock_guard<std::mutex> lock(global);
+	LockGuard lock(global);
 	ma_context* context = new ma_context();
 	if(ma_context_init(NULL, 0, NULL, context) != MA_SUCCESS){
 		std::cout << "Failed to initialize context" << std::endl;
 		delete context;
-		return AudioContext{nullptr, nullptr, false, nullptr};
+		return AudioContext{nullptr, nullptr, false, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, 0, 0};
 	}
 
 	endCallback = end_callback;
 
-	return AudioContext{context, new std::unordered_map<size_t, SoundClip*>, true, new std::mutex()};
+	EventWorker* worker = new EventWorker;
+	worker->events.init(1024);
+	worker->handled.store(0, std::memory_order_relaxed);
+	worker->stop.store(false, std::memory_order_relaxed);
+	worker->thread = std::thread(eventLoop, worker);
+
+	LoadWorker* loader = new LoadWorker;
+	loader->stop = false;
+	loader->thread = std::thread(loadLoop, loader);
+
+	ClipPool* pool = new ClipPool;
+	pool->init();
+
+	DeviceRegistry* devices = new DeviceRegistry;
+	devices->valid = false;
+
+	return AudioContext{
+		context,
+		new ClipRegistry,
+		true,
+		new std::mutex(),
+		new std::vector<OutputDevice*>(),
+		new std::unordered_map<std::string, PcmBuffer*>,
+		new std::mutex(),
+		worker,
+		loader,
+		pool,
+		devices,
+		defaultStreamThreshold,
+		0 //cache budget, unbounded until setCacheBudget is called
+	};
 }
 
 extern "C" void uninit(AudioContext* context) {
-	std::lock_guard<std::mutex> lock(global);
+	LockGuard lock(global);
+	{
+		LockGuard loaderLock(context->loader->mtx);
+		context->loader->stop = true;
+	}
+	context->loader->cv.notify_one();
+	context->loader->thread.join();
+	delete context->loader;
+	context->worker->stop.store(true, std::memory_order_release);
+	context->worker->thread.join();
+	delete context->worker;
+	for(OutputDevice* output : *context->outputs) {
+		ma_device_uninit(&output->device);
+		delete output;
+	}
+	delete context->outputs;
+	for(auto& entry : *context->cache) {
+		delete entry.second;
+	}
+	delete context->cache;
+	delete context->cacheMtx;
 	delete context->soundClips;
+	delete context->pool;
+	delete context->devices;
 	ma_context_uninit(context->context);
 	delete context->mtx;
 }
 
 extern "C" void setVolume(size_t id, AudioContext* context, float value) {
-	context->soundClips->at(id)->device.masterVolumeFactor = value;
+	context->soundClips->get(id)->volume.store(value, std::memory_order_relaxed);
 }
 
 extern "C" float getVolume(size_t id, AudioContext* context) {
-	return context->soundClips->at(id)->device.masterVolumeFactor;
+	return context->soundClips->get(id)->volume.load(std::memory_order_relaxed);
 }
 
 extern "C" void play(size_t id, AudioContext* context){
-	if(!ma_device_is_started(&context->soundClips->at(id)->device)){
-		if(ma_device_start(&context->soundClips->at(id)->device) != MA_SUCCESS) {
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	clip->playing.store(true, std::memory_order_relaxed);
+	if(!ma_device_is_started(&clip->output->device)){
+		if(ma_device_start(&clip->output->device) != MA_SUCCESS) {
 			std::cout << "Failed to start playback" << std::endl;
 		}
 	}
 }
 
 extern "C" void reset(size_t id, AudioContext* context) {
-	std::lock_guard<std::mutex> lock(context->soundClips->at(id)->mtx);
-	ma_device_stop(&context->soundClips->at(id)->device);
-	ma_decoder_seek_to_pcm_frame(&context->soundClips->at(id)->decoder, 0);
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	clip->playing.store(false, std::memory_order_relaxed);
+	seekClip(clip->output, clip, 0);
 }
 
 extern "C" void stop(size_t id, AudioContext* context) {
-	ma_device_stop(&context->soundClips->at(id)->device);
+	context->soundClips->get(id)->playing.store(false, std::memory_order_relaxed);
 }
 
-extern "C" int load(size_t id, AudioContext* context, const char* path, AudioDevice* device) {
-	SoundClip* soundClip = new SoundClip;
+//caller must hold context->mtx, snapToZero restarts the envelope at silence
+//before the ramp so a fade in never pops
+static void fadeClip(SoundClip* clip, float target, ma_uint64 frames, bool stopAtEnd, bool snapToZero) {
+	OutputDevice* output = clip->output;
+	if(ma_device_is_started(&output->device)) {
+		if(snapToZero) {
+			pushCommand(output, Command{commandFade, clip, 0, 0, false, nullptr});
+		}
+		pushCommand(output, Command{commandFade, clip, frames, target, stopAtEnd, nullptr});
+	} else {
+		if(snapToZero) {
+			clip->fadeGain = 0;
+		}
+		clip->fadeTarget = target;
+		clip->fadeFrames = frames;
+		clip->stopOnFadeEnd = stopAtEnd;
+		if(frames == 0) {
+			clip->fadeGain = target;
+			clip->fadeStep = 0;
+		} else {
+			clip->fadeStep = (target - clip->fadeGain) / (float)frames;
+		}
+	}
+}
+
+//buffer voices resample to whatever rate their output runs at, recomputed
+//when a clip moves between devices, only safe while the clip is detached
+static void updateStep(SoundClip* clip) {
+	if(clip->streaming || clip->buffer == nullptr) {
+		return;
+	}
+	clip->baseStep = clip->buffer->sampleRate != clip->output->device.sampleRate
+		? (double)clip->buffer->sampleRate / (double)clip->output->device.sampleRate
+		: 1.0;
+	clip->step = clip->baseStep * clip->rate;
+}
+
+static ma_uint64 fadeFrameCount(SoundClip* clip, uint64_t ms) {
+	return ms * clip->output->device.sampleRate / 1000;
+}
+
+//ramps the clip from silence to full gain and starts it
+extern "C" void fadeIn(size_t id, AudioContext* context, uint64_t ms) {
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	fadeClip(clip, 1, fadeFrameCount(clip, ms), false, true);
+	clip->playing.store(true, std::memory_order_relaxed);
+	if(!ma_device_is_started(&clip->output->device)) {
+		if(ma_device_start(&clip->output->device) != MA_SUCCESS) {
+			std::cout << "Failed to start playback" << std::endl;
+		}
+	}
+}
+
+//ramps the clip to silence and stops it at the exact end of the ramp, the
+//callback flips playing off itself so there is no pop and no extra thread
+extern "C" void fadeOut(size_t id, AudioContext* context, uint64_t ms) {
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	fadeClip(clip, 0, fadeFrameCount(clip, ms), true, false);
+}
+
+//fades one clip out while fading the other in over the same window
+extern "C" void crossfadeTo(size_t id, size_t other, AudioContext* context, uint64_t ms) {
+	LockGuard lock(*context->mtx);
+	SoundClip* from = context->soundClips->get(id);
+	SoundClip* to = context->soundClips->get(other);
+	fadeClip(from, 0, fadeFrameCount(from, ms), true, false);
+	fadeClip(to, 1, fadeFrameCount(to, ms), false, true);
+	to->playing.store(true, std::memory_order_relaxed);
+	if(!ma_device_is_started(&to->output->device)) {
+		if(ma_device_start(&to->output->device) != MA_SUCCESS) {
+			std::cout << "Failed to start playback" << std::endl;
+		}
+	}
+}
+
+//pitch and speed together, a per voice ratio folded into the resampling
+//stage so one asset serves every pitch variant, streaming voices mix
+//straight from the decode ring and are not affected
+extern "C" void setPlaybackRate(size_t id, AudioContext* context, float rate) {
+	if(rate <= 0) {
+		return;
+	}
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	if(clip->streaming) {
+		return;
+	}
+	clip->rate = rate;
+	if(ma_device_is_started(&clip->output->device)) {
+		pushCommand(clip->output, Command{commandRate, clip, 0, rate, false, nullptr});
+	} else {
+		clip->step = clip->baseStep * rate;
+	}
+}
+
+//creates and decodes a clip without registering it, safe to run on any
+//thread, the caller registers the clip afterwards under context->mtx
+static SoundClip* createClip(size_t id, AudioContext* context, const char* path, const void* data, size_t dataLen, OutputDevice* output, int mode, int* error) {
+	SoundClip* soundClip = context->pool->alloc();
 	soundClip->id = id;
-	soundClip->audioDevice = device;
+	soundClip->context = context;
+	soundClip->output = output;
 	soundClip->outer = nullptr;
+	soundClip->buffer = nullptr;
+	soundClip->cursor.store(0, std::memory_order_relaxed);
+	soundClip->srcPos = 0;
+	soundClip->step = 1.0;
+	soundClip->baseStep = 1.0;
+	soundClip->rate = 1;
+	soundClip->oneShot = false;
+	soundClip->nextClip = nullptr;
+	soundClip->fadeGain = 1;
+	soundClip->fadeTarget = 1;
+	soundClip->fadeStep = 0;
+	soundClip->fadeFrames = 0;
+	soundClip->stopOnFadeEnd = false;
+	soundClip->volume.store(1, std::memory_order_relaxed);
+	soundClip->playing.store(false, std::memory_order_relaxed);
+	soundClip->detached.store(false, std::memory_order_relaxed);
+	if(mode == modeAuto) {
+		long sourceSize = data != nullptr ? (long)dataLen : fileSize(path);
+		soundClip->streaming = sourceSize >= (long)context->streamThreshold;
+		//a full cache means every cached buffer is held by a live voice and
+		//nothing can be evicted, fall back to streaming rather than push the
+		//cache further over its budget
+		if(!soundClip->streaming && data == nullptr && context->cacheBudget != 0
+			&& getCacheMemoryUsage(context) >= context->cacheBudget) {
+			soundClip->streaming = true;
+		}
+	} else {
+		soundClip->streaming = mode == modeStream;
+	}
+
+	if(soundClip->streaming) {
+		//big source, keep a decoder on its own thread feeding the ring
+		ma_decoder_config decoderConfig = ma_decoder_config_init(
+			ma_format_f32,
+			output->device.playback.channels,
+			output->device.sampleRate
+		);
+		if(data != nullptr) {
+			//the caller's buffer is borrowed, it has to outlive the clip
+			if(ma_decoder_init_memory(data, dataLen, &decoderConfig, &soundClip->decoder) != MA_SUCCESS) {
+				context->pool->free(soundClip);
+				*error = -1;
+				return nullptr;
+			}
+		} else if(soundClip->map.open(path, true)) {
+			if(ma_decoder_init_memory(soundClip->map.data, soundClip->map.size, &decoderConfig, &soundClip->decoder) != MA_SUCCESS) {
+				soundClip->map.close();
+				context->pool->free(soundClip);
+				*error = -1;
+				return nullptr;
+			}
+		} else if(ma_decoder_init_file(path, &decoderConfig, &soundClip->decoder) != MA_SUCCESS) {
+			context->pool->free(soundClip);
+			*error = -1;
+			return nullptr;
+		}
+		//mp3 is the only bitstream without a frame index, bind one so seeks
+		//do not re-decode linearly from frame zero
+		soundClip->seekTable = buildMp3SeekIndex(&soundClip->decoder);
+		soundClip->streamFrames = ma_decoder_get_length_in_pcm_frames(&soundClip->decoder);
+		soundClip->sampleRate = soundClip->decoder.outputSampleRate;
+		soundClip->channels = soundClip->decoder.outputChannels;
+		soundClip->durationMs = soundClip->streamFrames / (soundClip->sampleRate / 1000);
+		soundClip->ring.init(16384 * soundClip->decoder.outputChannels);
+		soundClip->stopDecode.store(false, std::memory_order_relaxed);
+		soundClip->seekRequest.store(false, std::memory_order_relaxed);
+		soundClip->seekTarget.store(0, std::memory_order_relaxed);
+		soundClip->endOfStream.store(false, std::memory_order_relaxed);
+		soundClip->ringFlush.store(0, std::memory_order_relaxed);
+		soundClip->decodeThread = std::thread(decodeLoop, soundClip);
+	} else {
+		//small source, decoded at the format and rate of the output so mixing is a multiply add
+		PcmBuffer* buffer;
+		if(data != nullptr) {
+			//no stable key to cache memory loads under, give the clip a private buffer
+			ma_decoder decoder;
+			ma_decoder_config decoderConfig = ma_decoder_config_init(
+				ma_format_f32,
+				output->device.playback.channels,
+				output->device.sampleRate
+			);
+			if(ma_decoder_init_memory(data, dataLen, &decoderConfig, &decoder) != MA_SUCCESS) {
+				context->pool->free(soundClip);
+				*error = -1;
+				return nullptr;
+			}
+			buffer = decodeAll(&decoder, output->device.playback.channels, output->device.sampleRate);
+			buffer->refs.store(1, std::memory_order_relaxed);
+			ma_decoder_uninit(&decoder);
+		} else {
+			buffer = acquireBuffer(context, path, output->device.playback.channels);
+		}
+		if(buffer == nullptr) {
+			context->pool->free(soundClip);
+			*error = -1;
+			return nullptr;
+		}
+		soundClip->buffer = buffer;
+		soundClip->sampleRate = buffer->sampleRate;
+		soundClip->channels = buffer->channels;
+		soundClip->durationMs = buffer->frameCount / (buffer->sampleRate / 1000);
+		if(buffer->sampleRate != output->device.sampleRate) {
+			soundClip->step = (double)buffer->sampleRate / (double)output->device.sampleRate;
+			soundClip->baseStep = soundClip->step;
+		}
+	}
+
+	return soundClip;
+}
+
+//shared load path for files (data == nullptr) and in memory sources
+static int loadClip(size_t id, AudioContext* context, const char* path, const void* data, size_t dataLen, AudioDevice* device, int mode) {
+	OutputDevice* output = getOutput(context, device);
+	if(output == nullptr) {
+		return -2;
+	}
+
+	int error = 0;
+	SoundClip* soundClip = createClip(id, context, path, data, dataLen, output, mode, &error);
+	if(soundClip == nullptr) {
+		return error;
+	}
+
+	LockGuard lock(*context->mtx);
+	attachClip(output, soundClip);
+	context->soundClips->insert(id, soundClip);
+
+	return 0;
+}
+
+extern "C" int load(size_t id, AudioContext* context, const char* path, AudioDevice* device) {
+	return loadClip(id, context, path, nullptr, 0, device, modeAuto);
+}
+
+//mode is a LoadMode, forcing modePreload drops the decoder and file handle at
+//load time no matter how big the file is
+extern "C" int loadWithMode(size_t id, AudioContext* context, const char* path, AudioDevice* device, int mode) {
+	return loadClip(id, context, path, nullptr, 0, device, mode);
+}
+
+extern "C" int loadFromMemory(size_t id, AudioContext* context, const void* data, size_t len, AudioDevice* device) {
+	return loadClip(id, context, nullptr, data, len, device, modeAuto);
+}
+
+//tunes the modeAuto split point, only affects loads after the call
+extern "C" void setPreloadThreshold(AudioContext* context, size_t bytes) {
+	context->streamThreshold = bytes;
+}
 
-	//creating and configuring decoder
-	if(ma_decoder_init_file(path, NULL, &soundClip->decoder) != MA_SUCCESS) {
-		ma_decoder_uninit(&soundClip->decoder);
-		delete soundClip;
+//caps the decoded pcm the cache may hold, 0 lifts the cap, shrinking the
+//budget evicts immediately down to whatever is not referenced by a voice
+extern "C" void setCacheBudget(AudioContext* context, size_t bytes) {
+	LockGuard lock(*context->cacheMtx);
+	context->cacheBudget = bytes;
+	evictCache(context);
+}
+
+extern "C" size_t getCacheMemoryUsage(AudioContext* context) {
+	LockGuard lock(*context->cacheMtx);
+	size_t usage = 0;
+	for(auto& entry : *context->cache) {
+		usage += entry.second->frames.size() * sizeof(float);
+	}
+	return usage;
+}
+
+//offline producer for the asset bank format, decodes every input at the
+//given channel count and packs the raw f32 pcm behind a clip table, run once
+//at build time so app startup never decodes these files again
+extern "C" int writeBank(const char* bankPath, const char* const* paths, size_t count, uint32_t channels) {
+	std::vector<PcmBuffer*> buffers;
+	for(size_t i = 0; i < count; ++i) {
+		PcmBuffer* buffer = decodeFile(paths[i], channels);
+		if(buffer == nullptr) {
+			std::cout << "failed to decode " << paths[i] << std::endl;
+			for(PcmBuffer* b : buffers) {
+				delete b;
+			}
+			return -1;
+		}
+		buffers.push_back(buffer);
+	}
+
+	std::ofstream file(bankPath, std::ios::binary);
+	if(!file) {
+		for(PcmBuffer* b : buffers) {
+			delete b;
+		}
 		return -1;
 	}
 
-	//configure device
-	soundClip->deviceConfig = ma_device_config_init(ma_device_type_playback);
-	soundClip->deviceConfig.playback.format   = soundClip->decoder.outputFormat;
-	soundClip->deviceConfig.playback.channels = soundClip->decoder.outputChannels;
-	soundClip->deviceConfig.sampleRate        = soundClip->decoder.outputSampleRate;
-	soundClip->deviceConfig.dataCallback      = data_callback;
-	soundClip->deviceConfig.pUserData         = soundClip;
+	BankHeader header{};
+	std::memcpy(header.magic, "EZBK", 4);
+	header.version = 1;
+	header.clipCount = (uint32_t)count;
+	file.write((const char*)&header, sizeof(header));
 
-	soundClip->deviceConfig.playback.pDeviceID = &device->id;
+	uint64_t offset = sizeof(BankHeader) + count * sizeof(BankEntry);
+	for(size_t i = 0; i < count; ++i) {
+		BankEntry entry{};
+		entry.offset = offset;
+		entry.frameCount = buffers[i]->frameCount;
+		entry.sampleRate = buffers[i]->sampleRate;
+		entry.channels = buffers[i]->channels;
+		const char* name = paths[i];
+		for(const char* p = paths[i]; *p != '\0'; ++p) {
+			if(*p == '/' || *p == '\\') {
+				name = p + 1;
+			}
+		}
+		std::strncpy(entry.name, name, sizeof(entry.name) - 1);
+		file.write((const char*)&entry, sizeof(entry));
+		offset += entry.frameCount * entry.channels * sizeof(float);
+	}
+	for(PcmBuffer* buffer : buffers) {
+		file.write((const char*)buffer->frames.data(), buffer->frameCount * buffer->channels * sizeof(float));
+		delete buffer;
+	}
+	return file.good() ? 0 : -1;
+}
 
-	if(ma_device_init(context->context, &soundClip->deviceConfig, &soundClip->device) != MA_SUCCESS) {
-		std::cout << "Failed to open playback device" << std::endl;
-		ma_decoder_uninit(&soundClip->decoder);
-		delete soundClip;
-		return -2;
+//one mmap call replaces every decode the bank's clips would have cost, the
+//clip table is validated up front so loads from it cannot run off the map
+extern "C" AudioBank* openBank(const char* path) {
+	AudioBank* bank = new AudioBank;
+	if(!bank->map.open(path, false)) {
+		delete bank;
+		return nullptr;
+	}
+	if(bank->map.size < sizeof(BankHeader)) {
+		bank->map.close();
+		delete bank;
+		return nullptr;
+	}
+	const BankHeader* header = (const BankHeader*)bank->map.data;
+	if(std::memcmp(header->magic, "EZBK", 4) != 0 || header->version != 1
+		|| bank->map.size < sizeof(BankHeader) + (size_t)header->clipCount * sizeof(BankEntry)) {
+		bank->map.close();
+		delete bank;
+		return nullptr;
+	}
+	const BankEntry* entries = (const BankEntry*)((const char*)bank->map.data + sizeof(BankHeader));
+	for(uint32_t i = 0; i < header->clipCount; ++i) {
+		const BankEntry& entry = entries[i];
+		//range checked term by term, offset + frameCount * channels * 4 in one
+		//expression can be made to wrap by a crafted bank and pass a <= size
+		//test while pointing outside the mapping, the rate bounds also keep
+		//the duration math (frameCount / (sampleRate / 1000)) away from a
+		//division by zero
+		if(entry.channels == 0 || entry.channels > 32
+			|| entry.sampleRate < 1000 || entry.sampleRate > 384000
+			|| entry.offset > bank->map.size
+			|| entry.offset % sizeof(float) != 0
+			|| entry.frameCount > (bank->map.size - entry.offset) / entry.channels / sizeof(float)) {
+			for(PcmBuffer* buffer : bank->clips) {
+				delete buffer;
+			}
+			bank->map.close();
+			delete bank;
+			return nullptr;
+		}
+		PcmBuffer* buffer = new PcmBuffer;
+		buffer->external = (const float*)((const char*)bank->map.data + entry.offset);
+		buffer->frameCount = entry.frameCount;
+		buffer->channels = entry.channels;
+		buffer->sampleRate = entry.sampleRate;
+		buffer->refs.store(0, std::memory_order_relaxed);
+		buffer->cached = true; //the bank owns it, releaseBuffer must never delete it
+		buffer->key = entry.name;
+		bank->clips.push_back(buffer);
 	}
+	return bank;
+}
 
-	soundClip->device.masterVolumeFactor = 1;
+//the caller has to remove every clip loaded from the bank first, the pcm they
+//reference goes away with the mapping
+extern "C" void closeBank(AudioBank* bank) {
+	for(PcmBuffer* buffer : bank->clips) {
+		delete buffer;
+	}
+	bank->map.close();
+	delete bank;
+}
+
+extern "C" size_t getBankClipCount(AudioBank* bank) {
+	return bank->clips.size();
+}
 
-	std::lock_guard<std::mutex> lock(*context->mtx);
-	context->soundClips->insert({id, soundClip});
+//same shape as the preload branch of createClip but the pcm already exists
+//in the mapping, no decode and no copy
+extern "C" int loadFromBank(size_t id, AudioContext* context, AudioBank* bank, size_t clipIndex, AudioDevice* device) {
+	if(clipIndex >= bank->clips.size()) {
+		return -1;
+	}
+	OutputDevice* output = getOutput(context, device);
+	if(output == nullptr) {
+		return -2;
+	}
+	PcmBuffer* buffer = bank->clips[clipIndex];
+	if(buffer->channels != output->device.playback.channels) {
+		return -1; //packed for a different speaker layout
+	}
+	buffer->refs.fetch_add(1, std::memory_order_relaxed);
 
+	SoundClip* soundClip = context->pool->alloc();
+	soundClip->id = id;
+	soundClip->context = context;
+	soundClip->output = output;
+	soundClip->outer = nullptr;
+	soundClip->buffer = buffer;
+	soundClip->cursor.store(0, std::memory_order_relaxed);
+	soundClip->srcPos = 0;
+	soundClip->step = buffer->sampleRate != output->device.sampleRate
+		? (double)buffer->sampleRate / (double)output->device.sampleRate
+		: 1.0;
+	soundClip->baseStep = soundClip->step;
+	soundClip->rate = 1;
+	soundClip->oneShot = false;
+	soundClip->nextClip = nullptr;
+	soundClip->streaming = false;
+	soundClip->fadeGain = 1;
+	soundClip->fadeTarget = 1;
+	soundClip->fadeStep = 0;
+	soundClip->fadeFrames = 0;
+	soundClip->stopOnFadeEnd = false;
+	soundClip->volume.store(1, std::memory_order_relaxed);
+	soundClip->playing.store(false, std::memory_order_relaxed);
+	soundClip->detached.store(false, std::memory_order_relaxed);
+	soundClip->sampleRate = buffer->sampleRate;
+	soundClip->channels = buffer->channels;
+	soundClip->durationMs = buffer->frameCount / (buffer->sampleRate / 1000);
+
+	LockGuard lock(*context->mtx);
+	attachClip(output, soundClip);
+	context->soundClips->insert(id, soundClip);
 	return 0;
 }
 
+//fire and forget playback, the voice comes from the clip pool and the pcm
+//from the shared cache so steady state one shots allocate nothing, the event
+//worker recycles the voice as soon as it ends
+extern "C" void playOneShot(AudioContext* context, const char* path, AudioDevice* device, float volume) {
+	OutputDevice* output = getOutput(context, device);
+	if(output == nullptr) {
+		return;
+	}
+	PcmBuffer* buffer = acquireBuffer(context, path, output->device.playback.channels);
+	if(buffer == nullptr) {
+		return;
+	}
+
+	SoundClip* clip = context->pool->alloc();
+	clip->id = 0; //one shots are never registered, there is no handle to them
+	clip->context = context;
+	clip->output = output;
+	clip->outer = nullptr;
+	clip->buffer = buffer;
+	clip->cursor.store(0, std::memory_order_relaxed);
+	clip->srcPos = 0;
+	clip->step = buffer->sampleRate != output->device.sampleRate
+		? (double)buffer->sampleRate / (double)output->device.sampleRate
+		: 1.0;
+	clip->baseStep = clip->step;
+	clip->rate = 1;
+	clip->oneShot = true;
+	clip->nextClip = nullptr;
+	clip->streaming = false;
+	clip->fadeGain = 1;
+	clip->fadeTarget = 1;
+	clip->fadeStep = 0;
+	clip->fadeFrames = 0;
+	clip->stopOnFadeEnd = false;
+	clip->volume.store(volume, std::memory_order_relaxed);
+	clip->playing.store(true, std::memory_order_relaxed);
+	clip->detached.store(false, std::memory_order_relaxed);
+	clip->sampleRate = buffer->sampleRate;
+	clip->channels = buffer->channels;
+	clip->durationMs = buffer->frameCount / (buffer->sampleRate / 1000);
+
+	LockGuard lock(*context->mtx);
+	attachClip(output, clip);
+	if(!ma_device_is_started(&output->device)) {
+		if(ma_device_start(&output->device) != MA_SUCCESS) {
+			std::cout << "Failed to start playback" << std::endl;
+		}
+	}
+}
+
+//runs on the event worker when a one shot finishes
+void recycleOneShot(SoundClip* clip) {
+	AudioContext* context = clip->context;
+	LockGuard lock(*context->mtx);
+	detachClip(clip->output, clip);
+	releaseBuffer(context, clip->buffer);
+	context->pool->free(clip);
+}
+
+//runs on the per context loader thread
+static void loadLoop(LoadWorker* worker) {
+	std::unique_lock<std::mutex> lock(worker->mtx);
+	while(!worker->stop) {
+		if(worker->requests.empty()) {
+			worker->cv.wait(lock);
+			continue;
+		}
+		LoadRequest request = std::move(worker->requests.front());
+		worker->requests.pop_front();
+		lock.unlock();
+		int result = loadClip(request.id, request.context, request.path.c_str(), nullptr, 0, &request.device, modeAuto);
+		request.callback(request.user, result);
+		lock.lock();
+	}
+}
+
+//queues a load on the loader thread and returns immediately, the callback
+//fires with the load() result code once the clip is ready (or failed)
+extern "C" void loadAsync(size_t id, AudioContext* context, const char* path, AudioDevice* device, void (*callback)(void* user, int result), void* user) {
+	{
+		LockGuard lock(context->loader->mtx);
+		context->loader->requests.push_back(LoadRequest{id, std::string(path), *device, callback, user, context});
+	}
+	context->loader->cv.notify_one();
+}
+
+//fans decoding out over a worker pool and registers every clip under a single
+//acquisition of context->mtx, results gets the per file load() return code
+extern "C" void loadBatch(const size_t* ids, const char* const* paths, size_t count, AudioContext* context, AudioDevice* device, int* results) {
+	OutputDevice* output = getOutput(context, device);
+	if(output == nullptr) {
+		for(size_t i = 0; i < count; ++i) {
+			results[i] = -2;
+		}
+		return;
+	}
+
+	std::vector<SoundClip*> clips(count, nullptr);
+	std::atomic<size_t> next{0};
+	size_t threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0) {
+		threadCount = 1;
+	}
+	if(threadCount > count) {
+		threadCount = count;
+	}
+
+	auto work = [&]() {
+		for(;;) {
+			size_t i = next.fetch_add(1, std::memory_order_relaxed);
+			if(i >= count) {
+				break;
+			}
+			int error = 0;
+			clips[i] = createClip(ids[i], context, paths[i], nullptr, 0, output, modeAuto, &error);
+			results[i] = clips[i] != nullptr ? 0 : error;
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for(size_t i = 0; i < threadCount; ++i) {
+		pool.emplace_back(work);
+	}
+	for(std::thread& thread : pool) {
+		thread.join();
+	}
+
+	LockGuard lock(*context->mtx);
+	for(size_t i = 0; i < count; ++i) {
+		if(clips[i] != nullptr) {
+			attachClip(output, clips[i]);
+			context->soundClips->insert(ids[i], clips[i]);
+		}
+	}
+}
+
+//queues next to start at the exact frame id ends on, the mixer splices the
+//transition inside one callback so there is no gap and no round trip through
+//the end callback
+extern "C" void queueNext(size_t id, size_t next, AudioContext* context) {
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	SoundClip* nextClip = context->soundClips->get(next);
+	if(nextClip->output != clip->output) {
+		//the splice happens inside one callback so both must mix on the same device
+		detachClip(nextClip->output, nextClip);
+		nextClip->output = clip->output;
+		updateStep(nextClip);
+		attachClip(clip->output, nextClip);
+	}
+	if(ma_device_is_started(&clip->output->device)) {
+		pushCommand(clip->output, Command{commandQueueNext, clip, 0, 0, false, nextClip});
+	} else {
+		clip->nextClip = nextClip;
+	}
+}
+
 extern "C" void setOuter(size_t id, AudioContext* context, void* outer) {
-	std::lock_guard<std::mutex> lock(*context->mtx);
-	context->soundClips->at(id)->outer = outer;
+	LockGuard lock(*context->mtx);
+	context->soundClips->get(id)->outer = outer;
 }
 
 extern "C" void removeSound(size_t id, AudioContext* context){
-	std::lock_guard<std::mutex> ctx_lock(*context->mtx);
-	std::lock_guard<std::mutex> lock(context->soundClips->at(id)->mtx);
-	ma_decoder_uninit(&context->soundClips->at(id)->decoder);
-	ma_device_uninit(&context->soundClips->at(id)->device);
-	
-	delete context->soundClips->at(id)->device.pUserData;
-	context->soundClips->erase(id);
+	SoundClip* clip;
+	size_t pending;
+	{
+		LockGuard ctx_lock(*context->mtx);
+		clip = context->soundClips->get(id);
+		detachClip(clip->output, clip);
+		context->soundClips->remove(id);
+		pending = context->worker->events.head.load(std::memory_order_acquire);
+	}
+	//the worker may still hold an end event for this clip, wait it out with
+	//the context mutex released, on_end callbacks are free to re-enter the
+	//api and would deadlock against us otherwise
+	while(context->worker->handled.load(std::memory_order_acquire) < pending) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	if(clip->streaming) {
+		clip->stopDecode.store(true, std::memory_order_release);
+		clip->decodeThread.join();
+		ma_decoder_uninit(&clip->decoder);
+		if(clip->seekTable != nullptr) {
+			freeMp3SeekIndex(clip->seekTable);
+		}
+		clip->map.close();
+	} else {
+		releaseBuffer(context, clip->buffer);
+	}
+	context->pool->free(clip);
 }
 
 
-extern "C" size_t getAudioDevices(AudioContext* context, AudioDevice* devices, size_t capacity) {
+//the snapshot goes stale after this long, miniaudio 0.10 has no context level
+//device change notification to invalidate on so polling UIs get at most one
+//real enumeration per window
+static const std::chrono::seconds deviceCacheTtl{2};
+
+//caller must hold registry->mtx
+static void refreshDevices(AudioContext* context) {
+	DeviceRegistry* registry = context->devices;
 	ma_device_info* playbackDeviceInfos;
 	ma_uint32 playbackDeviceCount;
-
 	if(ma_context_get_devices(context->context, &playbackDeviceInfos, &playbackDeviceCount, NULL, NULL) != MA_SUCCESS) {
 		std::cout << "Failed to retrieve device information" << std::endl;
-		return 0;
+		return;
+	}
+
+	registry->names.clear();
+	registry->devices.clear();
+	registry->names.reserve(playbackDeviceCount);
+	registry->devices.reserve(playbackDeviceCount);
+	for(ma_uint32 i = 0; i < playbackDeviceCount; ++i) {
+		registry->names.emplace_back(playbackDeviceInfos[i].name);
 	}
-	
-	ma_uint32 i{0};
-	for (; i < playbackDeviceCount && i < capacity; ++i) {
-		devices[i] = AudioDevice{
-			playbackDeviceInfos[i].id,
-			playbackDeviceInfos[i].name
-		};
+	for(ma_uint32 i = 0; i < playbackDeviceCount; ++i) {
+		registry->devices.push_back(AudioDevice{playbackDeviceInfos[i].id, registry->names[i].c_str()});
+	}
+
+	registry->defaultDevice = AudioDevice{};
+	registry->defaultName.clear();
+	for(ma_uint32 i = 0; i < playbackDeviceCount; ++i) {
+		if(playbackDeviceInfos[i].isDefault || i == 0) {
+			registry->defaultName = playbackDeviceInfos[i].name;
+			registry->defaultDevice = AudioDevice{playbackDeviceInfos[i].id, nullptr};
+			if(playbackDeviceInfos[i].isDefault) {
+				break;
+			}
+		}
+	}
+	registry->defaultDevice.name = registry->defaultName.c_str();
+
+	registry->valid = playbackDeviceCount > 0;
+	registry->refreshed = std::chrono::steady_clock::now();
+}
+
+//caller must hold registry->mtx
+static void freshenDevices(AudioContext* context) {
+	DeviceRegistry* registry = context->devices;
+	if(!registry->valid || std::chrono::steady_clock::now() - registry->refreshed >= deviceCacheTtl) {
+		refreshDevices(context);
+	}
+}
+
+//forces a re-enumeration, for apps that want to react to a plugged in headset
+//faster than the cache window
+extern "C" void refreshAudioDevices(AudioContext* context) {
+	LockGuard lock(context->devices->mtx);
+	refreshDevices(context);
+}
+
+extern "C" size_t getAudioDevices(AudioContext* context, AudioDevice* devices, size_t capacity) {
+	DeviceRegistry* registry = context->devices;
+	LockGuard lock(registry->mtx);
+	freshenDevices(context);
+	size_t i = 0;
+	for(; i < registry->devices.size() && i < capacity; ++i) {
+		devices[i] = registry->devices[i];
 	}
 	return i;
 }
 
 extern "C" size_t getAudioDeviceCount(AudioContext* context){
-	ma_uint32 playbackDeviceCount;
-	if(ma_context_get_devices(context->context, NULL, &playbackDeviceCount, NULL, NULL) != MA_SUCCESS) {
-		std::cout << "Failed to retrieve device information" << std::endl;
-		return 0;
-	}
-	return playbackDeviceCount;
+	LockGuard lock(context->devices->mtx);
+	freshenDevices(context);
+	return context->devices->devices.size();
 }
 
 extern "C" void setAudioDevice(size_t id, AudioContext* context, AudioDevice* device){
-	std::lock_guard<std::mutex> lock(context->soundClips->at(id)->mtx);
-	ma_device_uninit(&context->soundClips->at(id)->device);
-	context->soundClips->at(id)->audioDevice = device;
-	context->soundClips->at(id)->deviceConfig.playback.pDeviceID = &device->id;
-	ma_device_init(context->context, &context->soundClips->at(id)->deviceConfig, &context->soundClips->at(id)->device);
+	OutputDevice* output = getOutput(context, device);
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	if(output == nullptr || output == clip->output) {
+		return;
+	}
+	detachClip(clip->output, clip);
+	clip->output = output;
+	updateStep(clip);
+	attachClip(output, clip);
+	if(clip->playing.load(std::memory_order_relaxed) && !ma_device_is_started(&output->device)) {
+		ma_device_start(&output->device);
+	}
 }
 
-extern "C" AudioDevice getDefaultAudioDevice(AudioContext* context){
-	ma_device_info* playbackDeviceInfos;
-	ma_uint32 playbackDeviceCount;
-	if(ma_context_get_devices(context->context, &playbackDeviceInfos, &playbackDeviceCount, NULL, NULL) != MA_SUCCESS) {
-		std::cout << "Failed to retrieve device information" << std::endl;
+//moves every clip to one output in one pass, no device teardown and no
+//position loss, the detaches are pushed together and acknowledged together so
+//rerouting costs one callback rather than one round trip per clip
+extern "C" void setAudioDeviceAll(AudioContext* context, AudioDevice* device) {
+	OutputDevice* output = getOutput(context, device);
+	if(output == nullptr) {
+		return;
 	}
-	for(size_t i{0}; i<playbackDeviceCount; ++i){
-		if(playbackDeviceInfos[i].isDefault) {
-			return AudioDevice{
-				playbackDeviceInfos[i].id,
-				playbackDeviceInfos[i].name
-			};
+	LockGuard lock(*context->mtx);
+
+	std::vector<SoundClip*> moved;
+	context->soundClips->forEach([&](SoundClip* clip) {
+		if(clip->output != output) {
+			moved.push_back(clip);
+		}
+	});
+
+	for(SoundClip* clip : moved) {
+		if(ma_device_is_started(&clip->output->device)) {
+			clip->detached.store(false, std::memory_order_relaxed);
+			pushCommand(clip->output, Command{commandDetach, clip, 0, 0, false, nullptr});
+		} else {
+			detachClip(clip->output, clip);
+		}
+	}
+
+	bool anyPlaying = false;
+	for(SoundClip* clip : moved) {
+		if(ma_device_is_started(&clip->output->device)) {
+			while(!clip->detached.load(std::memory_order_acquire)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		clip->output = output;
+		updateStep(clip);
+		attachClip(output, clip);
+		anyPlaying = anyPlaying || clip->playing.load(std::memory_order_relaxed);
+	}
+	if(anyPlaying && !ma_device_is_started(&output->device)) {
+		if(ma_device_start(&output->device) != MA_SUCCESS) {
+			std::cout << "Failed to start playback" << std::endl;
 		}
 	}
-	return AudioDevice{
-		playbackDeviceInfos[0].id,
-		playbackDeviceInfos[0].name
-	};
+}
+
+extern "C" AudioDevice getDefaultAudioDevice(AudioContext* context){
+	LockGuard lock(context->devices->mtx);
+	freshenDevices(context);
+	return context->devices->defaultDevice;
 }
 
 extern "C" uint64_t getDuration(size_t id, AudioContext* context){
-	uint64_t sampleRate{context->soundClips->at(id)->device.sampleRate};
-	uint64_t duration{ma_decoder_get_length_in_pcm_frames(&context->soundClips->at(id)->decoder)};
-	return duration/(sampleRate/1000);
+	return context->soundClips->get(id)->durationMs;
+}
+
+//one relaxed load of the frame counter the callback keeps, never touches a decoder
+extern "C" uint64_t getCursorMs(size_t id, AudioContext* context) {
+	SoundClip* clip = context->soundClips->get(id);
+	return clip->cursor.load(std::memory_order_relaxed) * 1000 / clip->sampleRate;
+}
+
+extern "C" void seekMs(size_t id, AudioContext* context, uint64_t ms) {
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	seekClip(clip->output, clip, ms * clip->sampleRate / 1000);
 }
 
 extern "C" bool isPlaying(size_t id, AudioContext* context){
-  	return ma_device_is_started(&context->soundClips->at(id)->device);
+  	return context->soundClips->get(id)->playing.load(std::memory_order_relaxed);
+}
+
+//server side rendering at cpu speed: pumps the clip through the exact mixer
+//pipeline live playback uses, clocked by this loop instead of a device. the
+//voice is moved to a detached offline output for the duration so the live
+//device never sees it mid render, and it renders from its current position
+//with its current volume, fade and rate settings. buffer is interleaved at
+//the output channel count; returns the frames pumped, short when the clip
+//ends first (the tail of the final block past the end is silence). the clip
+//has to be stopped, and the context mutex is held for the whole render so
+//structural calls from other threads wait it out
+extern "C" uint64_t renderOffline(size_t id, AudioContext* context, float* buffer, uint64_t frames) {
+	LockGuard lock(*context->mtx);
+	SoundClip* clip = context->soundClips->get(id);
+	if(clip->playing.load(std::memory_order_relaxed) || frames == 0) {
+		return 0;
+	}
+
+	OutputDevice* live = clip->output;
+	ma_uint32 channels = live->device.playback.channels;
+	detachClip(live, clip);
+
+	//a device struct the callback can read but no backend ever starts
+	OutputDevice offline;
+	ma_device device;
+	std::memset(&device, 0, sizeof(device));
+	device.playback.channels = channels;
+	device.pUserData = &offline;
+	offline.context = context;
+	offline.scratch.resize(8192 * channels);
+	offline.commands.init(2);
+	offline.stats.init();
+	offline.clips.push_back(clip);
+
+	clip->playing.store(true, std::memory_order_relaxed);
+	const ma_uint32 chunk = 512;
+	uint64_t rendered = 0;
+	while(rendered < frames && clip->playing.load(std::memory_order_relaxed)) {
+		ma_uint32 want = frames - rendered < chunk ? (ma_uint32)(frames - rendered) : chunk;
+		if(clip->streaming) {
+			//decoding is the bottleneck at cpu speed, wait for the ring so a
+			//starved read never drops frames out of the mixdown
+			skipStaleRing(clip);
+			while(clip->ring.availableRead() < (size_t)want * channels
+				&& !clip->endOfStream.load(std::memory_order_acquire)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+		data_callback(&device, buffer + rendered * channels, nullptr, want);
+		rendered += want;
+	}
+
+	clip->playing.store(false, std::memory_order_relaxed);
+	offline.clips.clear();
+	attachClip(live, clip);
+	return rendered;
+}
+
+//aggregates the per output counters into one snapshot, relaxed loads so the
+//picture can be a block stale but reading it never perturbs the callback
+extern "C" void getStats(AudioContext* context, EngineStats* stats) {
+	std::memset(stats, 0, sizeof(EngineStats));
+	stats->minCallbackUs = UINT64_MAX;
+	stats->minRingFill = 1.0f;
+	uint64_t buckets[32] = {};
+
+	LockGuard lock(*context->mtx);
+	for(OutputDevice* output : *context->outputs) {
+		stats->callbacks += output->stats.callbacks.load(std::memory_order_relaxed);
+		stats->framesRendered += output->stats.framesRendered.load(std::memory_order_relaxed);
+		stats->underruns += output->stats.underruns.load(std::memory_order_relaxed);
+		stats->activeVoices += output->stats.activeVoices.load(std::memory_order_relaxed);
+		uint64_t min = output->stats.minCallbackUs.load(std::memory_order_relaxed);
+		uint64_t max = output->stats.maxCallbackUs.load(std::memory_order_relaxed);
+		if(min < stats->minCallbackUs) {
+			stats->minCallbackUs = min;
+		}
+		if(max > stats->maxCallbackUs) {
+			stats->maxCallbackUs = max;
+		}
+		for(size_t i = 0; i < 32; ++i) {
+			buckets[i] += output->stats.durationBuckets[i].load(std::memory_order_relaxed);
+		}
+	}
+	if(stats->minCallbackUs == UINT64_MAX) {
+		stats->minCallbackUs = 0; //no callback has run yet
+	}
+
+	//p99 from the merged log2 histogram, the bucket upper bound is the estimate
+	uint64_t cutoff = stats->callbacks - stats->callbacks / 100;
+	uint64_t seen = 0;
+	for(size_t i = 0; i < 32 && stats->callbacks > 0; ++i) {
+		seen += buckets[i];
+		if(seen >= cutoff) {
+			stats->p99CallbackUs = (uint64_t)1 << (i + 1);
+			break;
+		}
+	}
+
+	context->soundClips->forEach([&](SoundClip* clip) {
+		if(clip->streaming) {
+			++stats->streamingVoices;
+			float fill = (float)clip->ring.availableRead() / (float)clip->ring.data.size();
+			if(fill < stats->minRingFill) {
+				stats->minRingFill = fill;
+			}
+		}
+	});
+}
+
+extern "C" void setTraceEnabled(bool enabled) {
+	traceRing.enabled.store(enabled, std::memory_order_release);
+}
+
+//copies out buffered trace events oldest first and consumes them, if the
+//writers lapped the reader the oldest events are gone and we say so by
+//skipping ahead, call this often enough and nothing is lost
+extern "C" size_t drainTrace(TraceEvent* events, size_t capacity) {
+	uint64_t write = traceRing.writePos.load(std::memory_order_acquire);
+	uint64_t read = traceRing.readPos.load(std::memory_order_relaxed);
+	if(write - read > TraceRing::capacity) {
+		read = write - TraceRing::capacity;
+	}
+	size_t count = 0;
+	while(read < write && count < capacity) {
+		events[count] = traceRing.events[read & (TraceRing::capacity - 1)];
+		++count;
+		++read;
+	}
+	traceRing.readPos.store(read, std::memory_order_release);
+	return count;
 }
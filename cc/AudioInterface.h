@@ -1,6 +1,7 @@
 #pragma once
 #include "AudioPlayer.h"
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <functional>
 #include <chrono>
@@ -20,20 +21,72 @@ extern "C" void reset(size_t id, AudioContext* context);
 
 extern "C" void stop(size_t id, AudioContext* context);
 
+extern "C" void fadeIn(size_t id, AudioContext* context, uint64_t ms);
+
+extern "C" void fadeOut(size_t id, AudioContext* context, uint64_t ms);
+
+extern "C" void crossfadeTo(size_t id, size_t other, AudioContext* context, uint64_t ms);
+
+extern "C" void setPlaybackRate(size_t id, AudioContext* context, float rate);
+
 extern "C" int load(size_t id, AudioContext* context, const char* path, AudioDevice* device);
 
+extern "C" int loadWithMode(size_t id, AudioContext* context, const char* path, AudioDevice* device, int mode);
+
+extern "C" void setPreloadThreshold(AudioContext* context, size_t bytes);
+
+extern "C" void setCacheBudget(AudioContext* context, size_t bytes);
+
+extern "C" size_t getCacheMemoryUsage(AudioContext* context);
+
+extern "C" int loadFromMemory(size_t id, AudioContext* context, const void* data, size_t len, AudioDevice* device);
+
+extern "C" int writeBank(const char* bankPath, const char* const* paths, size_t count, uint32_t channels);
+
+extern "C" AudioBank* openBank(const char* path);
+
+extern "C" void closeBank(AudioBank* bank);
+
+extern "C" size_t getBankClipCount(AudioBank* bank);
+
+extern "C" int loadFromBank(size_t id, AudioContext* context, AudioBank* bank, size_t clipIndex, AudioDevice* device);
+
+extern "C" void loadBatch(const size_t* ids, const char* const* paths, size_t count, AudioContext* context, AudioDevice* device, int* results);
+
+extern "C" void loadAsync(size_t id, AudioContext* context, const char* path, AudioDevice* device, void (*callback)(void* user, int result), void* user);
+
+extern "C" void playOneShot(AudioContext* context, const char* path, AudioDevice* device, float volume);
+
+extern "C" void queueNext(size_t id, size_t next, AudioContext* context);
+
 extern "C" void setOuter(size_t id, AudioContext* context, void* outer);
 
 extern "C" void removeSound(size_t id, AudioContext* context);
 
+extern "C" void refreshAudioDevices(AudioContext* context);
+
 extern "C" size_t getAudioDevices(AudioContext* context, AudioDevice* devices, size_t capacity);
 
 extern "C" size_t getAudioDeviceCount(AudioContext* context);
 
 extern "C" void setAudioDevice(size_t id, AudioContext* context, AudioDevice* device);
 
+extern "C" void setAudioDeviceAll(AudioContext* context, AudioDevice* device);
+
 extern "C" AudioDevice getDefaultAudioDevice(AudioContext* context);
 
 extern "C" uint64_t getDuration(size_t id, AudioContext* context);
 
+extern "C" uint64_t getCursorMs(size_t id, AudioContext* context);
+
+extern "C" void seekMs(size_t id, AudioContext* context, uint64_t ms);
+
 extern "C" bool isPlaying(size_t id, AudioContext* context);
+
+extern "C" uint64_t renderOffline(size_t id, AudioContext* context, float* buffer, uint64_t frames);
+
+extern "C" void getStats(AudioContext* context, EngineStats* stats);
+
+extern "C" void setTraceEnabled(bool enabled);
+
+extern "C" size_t drainTrace(TraceEvent* events, size_t capacity);
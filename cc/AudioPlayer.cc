@@ -2,39 +2,348 @@
 #include "stb_vorbis.c"
 #define MINIAUDIO_IMPLEMENTATION
 #include "AudioPlayer.h"
+#include "MixKernels.h"
 #undef STB_VORBIS_HEADER_ONLY
 #include "stb_vorbis.c"
 
 //https://miniaud.io/docs/examples/simple_mixing.html
-//TODO add mixing
-//give every context one device
-//probably separeating device and context to match api
-//this is clearly worng but it do work for now
+//every physical output has exactly one ma_device, clips are voices summed here
+
+//mixes one block of a clip through its gain envelope, the ramp runs per frame
+//until it finishes and the rest of the block is mixed flat
+static void mixClip(SoundClip* clip, float* dst, const float* src, ma_uint64 frames, ma_uint32 channels, float volume) {
+	if(clip->fadeFrames > 0) {
+		ma_uint64 rampFrames = frames < clip->fadeFrames ? frames : clip->fadeFrames;
+		clip->fadeGain = mixAddRamp(dst, src, (size_t)rampFrames, channels, volume, clip->fadeGain, clip->fadeStep);
+		clip->fadeFrames -= rampFrames;
+		dst += rampFrames * channels;
+		src += rampFrames * channels;
+		frames -= rampFrames;
+		if(clip->fadeFrames == 0) {
+			clip->fadeGain = clip->fadeTarget; //kill any rounding drift
+			if(clip->stopOnFadeEnd) {
+				clip->stopOnFadeEnd = false;
+				clip->playing.store(false, std::memory_order_relaxed);
+				return;
+			}
+		}
+	}
+	mixAdd(dst, src, (size_t)(frames * channels), volume * clip->fadeGain);
+}
+
+//same envelope split as mixClip but through the resampler, the gain step is
+//threaded into the kernel so fades stay sample accurate at any rate ratio
+static ma_uint64 resampleClip(SoundClip* clip, float* dst, const PcmBuffer* buffer, ma_uint64 frames, ma_uint32 channels, float volume) {
+	ma_uint64 wrote = 0;
+	if(clip->fadeFrames > 0) {
+		ma_uint64 rampFrames = frames < clip->fadeFrames ? frames : clip->fadeFrames;
+		size_t rendered = mixAddResample(dst, buffer->data(), (size_t)buffer->frameCount, channels,
+			(size_t)rampFrames, volume * clip->fadeGain, volume * clip->fadeStep, clip->step, &clip->srcPos);
+		clip->fadeGain += clip->fadeStep * rendered;
+		clip->fadeFrames -= rendered;
+		wrote += rendered;
+		dst += rendered * channels;
+		frames -= rendered;
+		if(rendered < rampFrames) {
+			return wrote; //source exhausted mid ramp
+		}
+		if(clip->fadeFrames == 0) {
+			clip->fadeGain = clip->fadeTarget;
+			if(clip->stopOnFadeEnd) {
+				clip->stopOnFadeEnd = false;
+				clip->playing.store(false, std::memory_order_relaxed);
+				return wrote;
+			}
+		}
+	}
+	wrote += mixAddResample(dst, buffer->data(), (size_t)buffer->frameCount, channels,
+		(size_t)frames, volume * clip->fadeGain, 0, clip->step, &clip->srcPos);
+	return wrote;
+}
+
+//renders a buffer voice into dst and advances its cursor, returns output
+//frames written so callers can spot the end of the clip
+static ma_uint64 renderBuffer(SoundClip* clip, float* dst, ma_uint32 frames, ma_uint32 channels, float volume) {
+	PcmBuffer* buffer = clip->buffer;
+	if(clip->step == 1.0) {
+		ma_uint64 cursor = clip->cursor.load(std::memory_order_relaxed);
+		//a cursor at or past the end means nothing left, the subtraction is
+		//unsigned and would otherwise wrap into a huge read
+		ma_uint64 framesLeft = cursor >= buffer->frameCount ? 0 : buffer->frameCount - cursor;
+		ma_uint64 framesRead = frames < framesLeft ? frames : framesLeft;
+		mixClip(clip, dst, buffer->data() + cursor * channels, framesRead, channels, volume);
+		clip->cursor.store(cursor + framesRead, std::memory_order_relaxed);
+		return framesRead;
+	}
+	ma_uint64 wrote = resampleClip(clip, dst, buffer, frames, channels, volume);
+	clip->cursor.store((ma_uint64)clip->srcPos, std::memory_order_relaxed);
+	return wrote;
+}
+
+//consumer half of a streaming seek, the decode thread marks everything written
+//before the seek as stale via ringFlush and the reader jumps over it here,
+//readPos only ever moves forward so a concurrent write never races us
+void skipStaleRing(SoundClip* clip) {
+	ma_uint64 flushTo = clip->ringFlush.load(std::memory_order_acquire);
+	if(clip->ring.readPos.load(std::memory_order_relaxed) < flushTo) {
+		clip->ring.readPos.store(flushTo, std::memory_order_release);
+	}
+}
+
+//mixes the head of a queued clip into the tail of the block so the transition
+//lands on the exact frame the previous clip ended on, streaming voices have
+//been pre-rolling their ring since load so the data is already decoded
+static void spliceNext(OutputDevice* out, SoundClip* next, float* dst, ma_uint32 frames, ma_uint32 channels) {
+	if(frames == 0) {
+		return;
+	}
+	float volume = next->volume.load(std::memory_order_relaxed);
+	if(next->streaming) {
+		skipStaleRing(next);
+		size_t got = next->ring.read(out->scratch.data(), frames * channels);
+		mixClip(next, dst, out->scratch.data(), got / channels, channels, volume);
+		next->cursor.fetch_add(got / channels, std::memory_order_relaxed);
+	} else {
+		renderBuffer(next, dst, frames, channels, volume);
+	}
+}
 
 void data_callback(ma_device* device, void* output, const void*, ma_uint32 framesToRead) {
-	SoundClip* clip = (SoundClip*)device->pUserData;
-	if(&clip->decoder == NULL){
-			return;
-	}
-	ma_uint64 framesRead = ma_decoder_read_pcm_frames(&clip->decoder, output, framesToRead);
-	if(framesRead < framesToRead){
-		std::lock_guard<std::mutex> lock(clip->mtx);
-		float oldVolume = device->masterVolumeFactor;
-		device->masterVolumeFactor = 0;
-		ma_decoder_seek_to_pcm_frame(&clip->decoder, 0);
-		resetDevice(device, clip, oldVolume);
-	}
-}
-
-void resetDevice(ma_device* device, SoundClip* clip, float const& oldVolume) {
-	std::thread t{[device, clip, oldVolume](){
-		std::lock_guard<std::mutex> lock(clip->mtx);
-		ma_device_stop(device);
-		ma_decoder_seek_to_pcm_frame(&clip->decoder, 0);
-		device->masterVolumeFactor = oldVolume;
-		endCallback(clip->outer);
-	}};
-	t.detach();
+	RT_CALLBACK_SCOPE();
+	traceEvent(traceCallbackEnter, framesToRead);
+	auto callbackStart = std::chrono::steady_clock::now();
+	OutputDevice* out = (OutputDevice*)device->pUserData;
+	float* dst = (float*)output;
+	ma_uint32 channels = device->playback.channels;
+	std::memset(dst, 0, sizeof(float) * framesToRead * channels);
+
+	//drain control plane commands, the callback is the only thread that ever
+	//touches the clip list while the device is running
+	Command command;
+	while(out->commands.pop(command)) {
+		traceEvent(traceCommand, command.type);
+		switch(command.type) {
+			case commandAttach:
+				out->clips.push_back(command.clip); //capacity reserved at device creation
+				break;
+			case commandDetach:
+				out->clips.erase(std::remove(out->clips.begin(), out->clips.end(), command.clip), out->clips.end());
+				//drop any queue reference before the clip is freed
+				for(SoundClip* other : out->clips) {
+					if(other->nextClip == command.clip) {
+						other->nextClip = nullptr;
+					}
+				}
+				command.clip->detached.store(true, std::memory_order_release);
+				break;
+			case commandSeek: {
+				//seekClip clamps too, but the command is the last line of defence
+				//before the cursor drives pointer arithmetic into the buffer
+				ma_uint64 frame = command.frame;
+				if(!command.clip->streaming && frame > command.clip->buffer->frameCount) {
+					frame = command.clip->buffer->frameCount;
+				}
+				command.clip->cursor.store(frame, std::memory_order_relaxed);
+				command.clip->srcPos = (double)frame;
+				break;
+			}
+			case commandFade:
+				command.clip->fadeTarget = command.gain;
+				command.clip->fadeFrames = command.frame;
+				command.clip->stopOnFadeEnd = command.stopAtEnd;
+				if(command.frame == 0) {
+					command.clip->fadeGain = command.gain;
+					command.clip->fadeStep = 0;
+				} else {
+					command.clip->fadeStep = (command.gain - command.clip->fadeGain) / (float)command.frame;
+				}
+				break;
+			case commandQueueNext:
+				command.clip->nextClip = command.next;
+				break;
+			case commandRate:
+				command.clip->step = command.clip->baseStep * command.gain;
+				break;
+		}
+	}
+
+	if(out->scratch.size() < framesToRead * channels) {
+		out->scratch.resize(framesToRead * channels);
+	}
+	uint32_t activeVoices = 0;
+	for(SoundClip* clip : out->clips) {
+		if(!clip->playing.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		++activeVoices;
+		float volume = clip->volume.load(std::memory_order_relaxed);
+		if(clip->streaming) {
+			//the decode thread fills the ring, all we do here is a wait free copy
+			skipStaleRing(clip);
+			size_t wanted = framesToRead * channels;
+			size_t got = clip->ring.read(out->scratch.data(), wanted);
+			mixClip(clip, dst, out->scratch.data(), got / channels, channels, volume);
+			clip->cursor.fetch_add(got / channels, std::memory_order_relaxed);
+			if(got < wanted && !clip->endOfStream.load(std::memory_order_acquire)) {
+				//decode thread fell behind, audible as crackle
+				out->stats.underruns.fetch_add(1, std::memory_order_relaxed);
+			}
+			if(got < wanted && clip->endOfStream.load(std::memory_order_acquire) && clip->ring.availableRead() == 0) {
+				clip->playing.store(false, std::memory_order_relaxed);
+				clip->cursor.store(0, std::memory_order_relaxed);
+				clip->seekTarget.store(0, std::memory_order_relaxed);
+				clip->seekRequest.store(true, std::memory_order_release);
+				SoundClip* next = clip->nextClip;
+				clip->nextClip = nullptr;
+				if(next != nullptr) {
+					next->playing.store(true, std::memory_order_relaxed);
+					spliceNext(out, next, dst + got, framesToRead - (ma_uint32)(got / channels), channels);
+				}
+				endOfClip(clip);
+			}
+			continue;
+		}
+		ma_uint64 framesRead = renderBuffer(clip, dst, framesToRead, channels, volume);
+		if(framesRead < framesToRead && clip->playing.load(std::memory_order_relaxed)) {
+			clip->playing.store(false, std::memory_order_relaxed);
+			clip->cursor.store(0, std::memory_order_relaxed);
+			clip->srcPos = 0;
+			SoundClip* next = clip->nextClip;
+			clip->nextClip = nullptr;
+			if(next != nullptr) {
+				next->playing.store(true, std::memory_order_relaxed);
+				spliceNext(out, next, dst + framesRead * channels, framesToRead - (ma_uint32)framesRead, channels);
+			}
+			endOfClip(clip);
+		}
+	}
+
+	//telemetry, relaxed atomics only and the callback is the sole writer so the
+	//min/max compares race with nothing
+	ma_uint64 us = (ma_uint64)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - callbackStart).count();
+	out->stats.callbacks.fetch_add(1, std::memory_order_relaxed);
+	out->stats.framesRendered.fetch_add(framesToRead, std::memory_order_relaxed);
+	out->stats.activeVoices.store(activeVoices, std::memory_order_relaxed);
+	if(us < out->stats.minCallbackUs.load(std::memory_order_relaxed)) {
+		out->stats.minCallbackUs.store(us, std::memory_order_relaxed);
+	}
+	if(us > out->stats.maxCallbackUs.load(std::memory_order_relaxed)) {
+		out->stats.maxCallbackUs.store(us, std::memory_order_relaxed);
+	}
+	int bucket = 0;
+	while(bucket < 31 && (us >> bucket) > 1) {
+		++bucket;
+	}
+	out->stats.durationBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	traceEvent(traceCallbackExit, activeVoices);
+}
+
+//runs on the per clip decode thread, keeps the ring topped up so the callback
+//never touches the decoder
+void decodeLoop(SoundClip* clip) {
+	float chunk[4096];
+	const size_t chunkSamples = sizeof(chunk) / sizeof(float);
+	size_t channels = clip->decoder.outputChannels;
+	while(!clip->stopDecode.load(std::memory_order_acquire)) {
+		if(clip->seekRequest.exchange(false, std::memory_order_acq_rel)) {
+			//everything queued so far belongs before the seek, flag it stale and
+			//let the consumer skip it, resetting the ring here would race a read
+			clip->ringFlush.store(clip->ring.writePos.load(std::memory_order_relaxed), std::memory_order_release);
+			clip->endOfStream.store(false, std::memory_order_relaxed);
+			ma_decoder_seek_to_pcm_frame(&clip->decoder, clip->seekTarget.load(std::memory_order_relaxed));
+		}
+		if(clip->endOfStream.load(std::memory_order_relaxed) || clip->ring.availableWrite() < chunkSamples) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			continue;
+		}
+		ma_uint64 frames = chunkSamples / channels;
+		traceEvent(traceDecodeStart, frames);
+		ma_uint64 framesRead = ma_decoder_read_pcm_frames(&clip->decoder, chunk, frames);
+		traceEvent(traceDecodeEnd, framesRead);
+		clip->ring.write(chunk, (size_t)(framesRead * channels));
+		if(framesRead < frames) {
+			clip->endOfStream.store(true, std::memory_order_release);
+		}
+	}
+}
+
+//called from the audio callback, pushing the event is all that happens on the
+//audio thread, the worker fires the user callback
+void endOfClip(SoundClip* clip) {
+	traceEvent(traceClipEnd, clip->id);
+	//if the queue is ever full the event is dropped rather than blocking the callback
+	clip->context->worker->events.push(Event{eventClipEnded, clip});
+}
+
+//runs on the per context worker thread
+void eventLoop(EventWorker* worker) {
+	while(!worker->stop.load(std::memory_order_acquire)) {
+		Event event;
+		bool idle = true;
+		while(worker->events.pop(event)) {
+			idle = false;
+			switch(event.type) {
+				case eventClipEnded:
+					if(event.clip->oneShot) {
+						//count it handled before recycling, recycling takes
+						//context->mtx and removeSound spins on handled while
+						//holding that same mutex
+						worker->handled.fetch_add(1, std::memory_order_release);
+						recycleOneShot(event.clip);
+						continue;
+					}
+					if(event.clip->outer != nullptr) {
+						endCallback(event.clip->outer);
+					}
+					break;
+			}
+			worker->handled.fetch_add(1, std::memory_order_release);
+		}
+		if(idle) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+//mp3 is the one format where ma_decoder seeks by re-decoding linearly from
+//frame zero, binding a drmp3 seek point table makes seeks near constant time,
+//the backend check compares against the mp3 seek callback which is only
+//visible in this translation unit
+void* buildMp3SeekIndex(ma_decoder* decoder) {
+	if(decoder->onSeekToPCMFrame != ma_decoder_internal_on_seek_to_pcm_frame__mp3) {
+		return nullptr; //not an mp3
+	}
+	drmp3* mp3 = (drmp3*)decoder->pInternalDecoder;
+	drmp3_uint32 count = 512;
+	drmp3_seek_point* points = new drmp3_seek_point[count];
+	if(!drmp3_calculate_seek_points(mp3, &count, points) || !drmp3_bind_seek_table(mp3, count, points)) {
+		delete[] points;
+		return nullptr;
+	}
+	return points;
+}
+
+void freeMp3SeekIndex(void* table) {
+	delete[] (drmp3_seek_point*)table;
+}
+
+TraceRing traceRing{};
+
+//when tracing is off this is one relaxed load and a predicted branch, when it
+//is on the write is a fetch_add and four plain stores, no locks either way so
+//the callback and decode threads can trace freely
+void traceEvent(uint32_t type, uint64_t arg) {
+	if(!traceRing.enabled.load(std::memory_order_relaxed)) {
+		return;
+	}
+	static std::atomic<uint32_t> nextThread{1};
+	thread_local uint32_t threadId = nextThread.fetch_add(1, std::memory_order_relaxed);
+	uint64_t pos = traceRing.writePos.fetch_add(1, std::memory_order_relaxed);
+	TraceEvent& event = traceRing.events[pos & (TraceRing::capacity - 1)];
+	event.timeUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	event.arg = arg;
+	event.type = type;
+	event.thread = threadId;
 }
 
 void (*endCallback)(void*) = nullptr;
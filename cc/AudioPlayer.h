@@ -1,14 +1,25 @@
 #pragma once
 #include "miniaudio.h"
+#include "RtAudit.h"
 #include <unordered_map>
+#include <vector>
 #include <thread>
 #include <functional>
 #include <atomic>
 #include <mutex>
 #include <array>
 #include <iostream>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <deque>
+#include <condition_variable>
+#include <new>
 
 struct AudioContext;
+struct OutputDevice;
 
 struct AudioDevice {
 	ma_device_id id;
@@ -20,25 +31,557 @@ struct AudioDeviceList {
     AudioDevice* devices;
 };
 
+//one decode of a file, shared by every clip loaded from the same path
+struct PcmBuffer {
+	std::vector<float> frames;
+	const float* external = nullptr; //points into a mapped bank, frames stays empty then
+	ma_uint64 frameCount;
+	ma_uint32 channels;
+	ma_uint32 sampleRate;
+	std::atomic<size_t> refs;
+	bool cached; //private buffers (memory loads) are freed when the last ref drops
+	std::string key;
+	uint64_t lastUsed = 0; //lru stamp for cache eviction, guarded by cacheMtx
+
+	const float* data() const {
+		return external != nullptr ? external : frames.data();
+	}
+};
+
+//mmap based file input so decoders read straight out of the page cache
+//instead of through stdio buffered reads, pages are shared between processes
+//loading the same asset, callers fall back to ma_decoder_init_file when open
+//fails or the platform has no mmap
+struct MappedFile {
+	const void* data;
+	size_t size;
+
+	MappedFile() : data(nullptr), size(0) {}
+	//sequential hints madvise for front to back streaming reads
+	bool open(const char* path, bool sequential);
+	void close();
+};
+
+//pre decoded asset bank: header, clip table, then raw f32 pcm, produced
+//offline by writeBank so startup pays one mmap instead of hundreds of
+//identical decodes, pages are shared between processes mapping the same bank
+struct BankHeader {
+	char magic[4]; //"EZBK"
+	uint32_t version;
+	uint32_t clipCount;
+	uint32_t reserved;
+};
+
+struct BankEntry {
+	uint64_t offset; //bytes from the start of the file to the pcm
+	uint64_t frameCount;
+	uint32_t sampleRate;
+	uint32_t channels;
+	char name[64]; //source file name, null terminated
+};
+
+//clips loaded from a bank reference the mapping directly with no copy, so
+//the bank has to outlive every clip loaded from it
+struct AudioBank {
+	MappedFile map;
+	std::vector<PcmBuffer*> clips;
+};
+
+//single producer single consumer lock free ring in samples, the decode thread
+//writes and the audio callback reads, neither ever blocks the other
+struct SpscRing {
+	std::vector<float> data;
+	size_t mask;
+	std::atomic<ma_uint64> readPos;
+	std::atomic<ma_uint64> writePos;
+
+	//capacity is rounded up to a power of two
+	void init(size_t capacity) {
+		size_t size = 1;
+		while(size < capacity) {
+			size <<= 1;
+		}
+		data.resize(size);
+		mask = size - 1;
+		readPos.store(0, std::memory_order_relaxed);
+		writePos.store(0, std::memory_order_relaxed);
+	}
+
+	size_t availableRead() const {
+		return (size_t)(writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed));
+	}
+
+	size_t availableWrite() const {
+		return data.size() - (size_t)(writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire));
+	}
+
+	size_t write(const float* src, size_t count) {
+		size_t space = availableWrite();
+		if(count > space) {
+			count = space;
+		}
+		ma_uint64 pos = writePos.load(std::memory_order_relaxed);
+		for(size_t i = 0; i < count; ++i) {
+			data[(pos + i) & mask] = src[i];
+		}
+		writePos.store(pos + count, std::memory_order_release);
+		return count;
+	}
+
+	size_t read(float* dst, size_t count) {
+		size_t avail = availableRead();
+		if(count > avail) {
+			count = avail;
+		}
+		ma_uint64 pos = readPos.load(std::memory_order_relaxed);
+		for(size_t i = 0; i < count; ++i) {
+			dst[i] = data[(pos + i) & mask];
+		}
+		readPos.store(pos + count, std::memory_order_release);
+		return count;
+	}
+};
+
+struct SoundClip;
+
+//how a clip gets its pcm, modeAuto picks by source size so short clips become
+//pure memory reads with no decoder or file handle kept alive and long ones
+//stream through the background decode ring
+enum LoadMode {
+	modeAuto = 0,
+	modePreload = 1,
+	modeStream = 2,
+};
+
+enum CommandType {
+	commandAttach,
+	commandDetach,
+	commandSeek,
+	commandFade, //frame carries the ramp length, 0 snaps straight to gain
+	commandQueueNext,
+	commandRate, //gain carries the playback rate multiplier
+};
+
+struct Command {
+	CommandType type;
+	SoundClip* clip;
+	ma_uint64 frame;
+	float gain;
+	bool stopAtEnd;
+	SoundClip* next;
+};
+
+//bounded lock free multi producer single consumer queue (Vyukov style),
+//producers never block the single consumer and pushing is allocation free
+template <typename T>
+struct MpscQueue {
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+	std::unique_ptr<Slot[]> slots;
+	size_t mask;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+
+	//capacity must be a power of two
+	void init(size_t capacity) {
+		slots.reset(new Slot[capacity]);
+		mask = capacity - 1;
+		for(size_t i = 0; i < capacity; ++i) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	bool push(const T& value) {
+		size_t pos = head.load(std::memory_order_relaxed);
+		for(;;) {
+			Slot& slot = slots[pos & mask];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)sequence - (intptr_t)pos;
+			if(dif == 0) {
+				if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					slot.value = value;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if(dif < 0) {
+				return false; //full
+			} else {
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool pop(T& value) {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Slot& slot = slots[pos & mask];
+		size_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if((intptr_t)sequence - (intptr_t)(pos + 1) < 0) {
+			return false; //empty
+		}
+		value = slot.value;
+		slot.sequence.store(pos + mask + 1, std::memory_order_release);
+		tail.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+};
+
+//the audio callback drains commands at the top of every callback, so the
+//callback never takes a lock a control thread can hold
+using CommandQueue = MpscQueue<Command>;
+
+enum EventType {
+	eventClipEnded,
+};
+
+struct Event {
+	EventType type;
+	SoundClip* clip;
+};
+
+//one persistent worker per context, the callback only ever pushes an event,
+//it never spawns threads or runs user callbacks itself
+struct EventWorker {
+	MpscQueue<Event> events;
+	std::atomic<ma_uint64> handled;
+	std::atomic<bool> stop;
+	std::thread thread;
+};
+
+//a clip no longer owns a device, it is a cursor into a shared PcmBuffer mixed
+//into the OutputDevice it is attached to, or for big files a streaming voice
+//fed by its own decode thread so no bitstream parsing happens in the callback
 struct SoundClip {
-	ma_device device;
+	PcmBuffer* buffer;
+	std::atomic<ma_uint64> cursor; //frames played, atomic so position queries are one relaxed load
+	//buffers are cached at their native rate, the voice resamples to the
+	//device rate at mix time, step 1 means no conversion and the simd path
+	double srcPos;   //fractional source frame position, owned by the callback
+	double step;     //source frames per output frame, baseStep * rate
+	double baseStep; //rate conversion alone, only changes while detached
+	float rate;      //playback rate multiplier, control side copy
+	size_t id;
+	std::atomic<float> volume;
+	std::atomic<bool> playing;
+	std::atomic<bool> detached;
+	bool oneShot; //recycled by the event worker when it ends, never registered
+	SoundClip* nextClip; //spliced in at the final frame, owned by the callback
+	OutputDevice* output;
+	AudioContext* context;
+	void* outer;
+
+	//gain envelope evaluated per frame in the callback, owned by the callback
+	//and only ever changed through commandFade while the device runs
+	float fadeGain;
+	float fadeTarget;
+	float fadeStep;
+	ma_uint64 fadeFrames; //frames left in the ramp, 0 when idle
+	bool stopOnFadeEnd;
+
+	//captured once at load so queries never touch a decoder again
+	uint64_t durationMs;
+	ma_uint32 sampleRate;
+	ma_uint32 channels;
+
+	//streaming only
+	bool streaming;
+	MappedFile map;
 	ma_decoder decoder;
+	SpscRing ring;
+	ma_uint64 streamFrames;
+	void* seekTable; //drmp3 seek points bound to the decoder, null when unused
+	std::thread decodeThread;
+	std::atomic<bool> stopDecode;
+	std::atomic<bool> seekRequest;
+	std::atomic<ma_uint64> seekTarget;
+	std::atomic<bool> endOfStream;
+	//everything written to the ring before this position is pre seek and
+	//stale, the consumer jumps over it (see skipStaleRing), resetting the
+	//ring from the decode thread would race a concurrent read
+	std::atomic<ma_uint64> ringFlush;
+};
+
+//fixed capacity pool for SoundClip allocations, fire and forget SFX churn
+//hundreds of clips per minute and SoundClip is big enough that going through
+//the general purpose allocator every time fragments long running sessions,
+//load/unload from the pool is an O(1) pointer pop
+struct ClipPool {
+	static const size_t capacity = 256;
+	std::vector<unsigned char> storage;
+	std::vector<SoundClip*> freeList;
+	std::mutex mtx;
+
+	void init() {
+		storage.resize(capacity * sizeof(SoundClip));
+		freeList.reserve(capacity);
+		for(size_t i = 0; i < capacity; ++i) {
+			freeList.push_back((SoundClip*)(storage.data() + i * sizeof(SoundClip)));
+		}
+	}
+
+	SoundClip* alloc() {
+		{
+			LockGuard lock(mtx);
+			if(!freeList.empty()) {
+				SoundClip* slot = freeList.back();
+				freeList.pop_back();
+				return new(slot) SoundClip;
+			}
+		}
+		//pool exhausted, fall back to the heap
+		return new SoundClip;
+	}
+
+	void free(SoundClip* clip) {
+		unsigned char* raw = (unsigned char*)clip;
+		if(raw >= storage.data() && raw < storage.data() + storage.size()) {
+			clip->~SoundClip();
+			LockGuard lock(mtx);
+			freeList.push_back(clip);
+		} else {
+			delete clip;
+		}
+	}
+};
+
+//per output performance counters, the callback is the only writer and uses
+//relaxed atomics so the cost per block is a few nanoseconds, readers get a
+//slightly stale but consistent enough picture for dashboards
+struct OutputStats {
+	std::atomic<uint64_t> callbacks;
+	std::atomic<uint64_t> framesRendered;
+	std::atomic<uint64_t> underruns; //streaming ring starved while not at end of stream
+	std::atomic<uint64_t> minCallbackUs;
+	std::atomic<uint64_t> maxCallbackUs;
+	std::atomic<uint64_t> durationBuckets[32]; //log2 microsecond histogram, p99 is derived at query time
+	std::atomic<uint32_t> activeVoices;
+
+	void init() {
+		callbacks.store(0, std::memory_order_relaxed);
+		framesRendered.store(0, std::memory_order_relaxed);
+		underruns.store(0, std::memory_order_relaxed);
+		minCallbackUs.store(UINT64_MAX, std::memory_order_relaxed);
+		maxCallbackUs.store(0, std::memory_order_relaxed);
+		for(size_t i = 0; i < 32; ++i) {
+			durationBuckets[i].store(0, std::memory_order_relaxed);
+		}
+		activeVoices.store(0, std::memory_order_relaxed);
+	}
+};
+
+//aggregate snapshot handed over the ffi, plain pod so rust can mirror it
+struct EngineStats {
+	uint64_t callbacks;
+	uint64_t framesRendered;
+	uint64_t underruns;
+	uint64_t minCallbackUs;
+	uint64_t maxCallbackUs;
+	uint64_t p99CallbackUs;
+	uint32_t activeVoices;
+	uint32_t streamingVoices;
+	float minRingFill; //lowest streaming ring fill level, 0..1, 1 when nothing streams
+};
+
+//one physical output, owns the only ma_device and mixes every attached clip in data_callback
+struct OutputDevice {
+	ma_device device;
 	ma_device_config deviceConfig;
-	size_t id;
+	ma_device_id deviceId;
+	std::vector<SoundClip*> clips; //only touched by the audio callback while the device runs
+	std::vector<float> scratch;
+	CommandQueue commands;
+	AudioContext* context;
+	OutputStats stats;
+};
+
+//wait free read mostly clip registry, ids handed out by the rust side are a
+//monotonically increasing counter so a paged slot array indexed directly by
+//the id replaces the old unordered_map + mutex, hot reads like isPlaying and
+//getVolume never contend with loads and removals, ids past the paged range
+//(they are never reused, so very long sessions get there) fall back to a
+//locked map instead of indexing off the end of the page array
+struct ClipRegistry {
+	static const size_t pageSize = 1024;
+	static const size_t maxPages = 1024;
+	std::atomic<std::atomic<SoundClip*>*> pages[maxPages];
+	mutable std::mutex growMtx;
+	std::unordered_map<size_t, SoundClip*> overflow; //guarded by growMtx
+
+	ClipRegistry() {
+		for(size_t i = 0; i < maxPages; ++i) {
+			pages[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	~ClipRegistry() {
+		for(size_t i = 0; i < maxPages; ++i) {
+			delete[] pages[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	SoundClip* get(size_t id) const {
+		if(id >= pageSize * maxPages) {
+			LockGuard lock(growMtx);
+			auto found = overflow.find(id);
+			return found != overflow.end() ? found->second : nullptr;
+		}
+		std::atomic<SoundClip*>* page = pages[id / pageSize].load(std::memory_order_acquire);
+		if(page == nullptr) {
+			return nullptr;
+		}
+		return page[id % pageSize].load(std::memory_order_acquire);
+	}
+
+	void insert(size_t id, SoundClip* clip) {
+		if(id >= pageSize * maxPages) {
+			LockGuard lock(growMtx);
+			overflow[id] = clip;
+			return;
+		}
+		std::atomic<SoundClip*>* page = pages[id / pageSize].load(std::memory_order_acquire);
+		if(page == nullptr) {
+			LockGuard lock(growMtx);
+			page = pages[id / pageSize].load(std::memory_order_relaxed);
+			if(page == nullptr) {
+				page = new std::atomic<SoundClip*>[pageSize](); //zeroed
+				pages[id / pageSize].store(page, std::memory_order_release);
+			}
+		}
+		page[id % pageSize].store(clip, std::memory_order_release);
+	}
+
+	void remove(size_t id) {
+		if(id >= pageSize * maxPages) {
+			LockGuard lock(growMtx);
+			overflow.erase(id);
+			return;
+		}
+		std::atomic<SoundClip*>* page = pages[id / pageSize].load(std::memory_order_acquire);
+		if(page == nullptr) {
+			return;
+		}
+		page[id % pageSize].store(nullptr, std::memory_order_release);
+	}
+
+	//visits every registered clip, only allocated pages are scanned
+	template <typename F>
+	void forEach(F&& visit) const {
+		for(size_t i = 0; i < maxPages; ++i) {
+			std::atomic<SoundClip*>* page = pages[i].load(std::memory_order_acquire);
+			if(page == nullptr) {
+				continue;
+			}
+			for(size_t j = 0; j < pageSize; ++j) {
+				SoundClip* clip = page[j].load(std::memory_order_acquire);
+				if(clip != nullptr) {
+					visit(clip);
+				}
+			}
+		}
+		LockGuard lock(growMtx);
+		for(const auto& entry : overflow) {
+			visit(entry.second);
+		}
+	}
+};
+
+//cached snapshot of the playback devices with owned name storage, enumeration
+//takes tens of milliseconds on wasapi/pulse so queries reuse the snapshot and
+//callers stop getting name pointers into a freed miniaudio array, the names
+//stay alive until the next refresh
+struct DeviceRegistry {
+	std::vector<AudioDevice> devices;
+	std::vector<std::string> names;
+	AudioDevice defaultDevice;
+	std::string defaultName;
+	std::chrono::steady_clock::time_point refreshed;
+	bool valid;
 	std::mutex mtx;
-	AudioDevice* audioDevice;
+};
+
+//a queued asynchronous load, the device is copied because the caller's
+//pointer does not outlive the loadAsync call
+struct LoadRequest {
+	size_t id;
+	std::string path;
+	AudioDevice device;
+	void (*callback)(void* user, int result);
+	void* user;
 	AudioContext* context;
-	void* outer;
+};
+
+//one persistent loader thread per context so loadAsync returns immediately
+//and slow disks never stall the caller
+struct LoadWorker {
+	std::deque<LoadRequest> requests;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stop;
+	std::thread thread;
 };
 
 struct AudioContext {
 	ma_context* context;
-	std::unordered_map<size_t, SoundClip*>* soundClips;
+	ClipRegistry* soundClips;
 	bool result;
 	std::mutex* mtx;
+	std::vector<OutputDevice*>* outputs;
+	std::unordered_map<std::string, PcmBuffer*>* cache;
+	std::mutex* cacheMtx;
+	EventWorker* worker;
+	LoadWorker* loader;
+	ClipPool* pool;
+	DeviceRegistry* devices;
+	size_t streamThreshold; //sources at least this big stream under modeAuto
+	size_t cacheBudget;     //decoded pcm byte budget, 0 means unbounded
+};
+
+//event level tracing for the rare glitch the aggregate counters cannot
+//explain, every hot path event is stamped into one global lock free ring
+enum TraceType {
+	traceCallbackEnter, //arg = frames requested
+	traceCallbackExit,  //arg = active voices
+	traceDecodeStart,   //arg = frames asked of the decoder
+	traceDecodeEnd,     //arg = frames the decoder produced
+	traceCommand,       //arg = CommandType
+	traceClipEnd,       //arg = clip id
 };
 
+//plain pod, mirrored on the rust side
+struct TraceEvent {
+	uint64_t timeUs; //steady clock microseconds
+	uint64_t arg;
+	uint32_t type;
+	uint32_t thread; //small per thread ordinal, not an os id
+};
+
+//multi producer via a relaxed fetch_add on the write index, writers never
+//wait and never branch on the reader, the drain can lose events under a
+//lapped writer and the newest slot can be torn mid write, both fine for a
+//diagnostic ring
+struct TraceRing {
+	static const size_t capacity = 16384; //power of two
+	TraceEvent events[capacity];
+	std::atomic<uint64_t> writePos;
+	std::atomic<uint64_t> readPos;
+	std::atomic<bool> enabled;
+};
+
+extern TraceRing traceRing;
+void traceEvent(uint32_t type, uint64_t arg);
+
 extern std::mutex global;
 extern void (*endCallback)(void*);
 void data_callback(ma_device* device, void* output, const void* input, ma_uint32 frameCount);
-void resetDevice(ma_device* device, SoundClip* clip, float const& oldVolume);
+void skipStaleRing(SoundClip* clip);
+void endOfClip(SoundClip* clip);
+void decodeLoop(SoundClip* clip);
+void eventLoop(EventWorker* worker);
+void recycleOneShot(SoundClip* clip); //defined in AudioInterface.cc
+//mp3 only, the drmp3 types live behind MINIAUDIO_IMPLEMENTATION so the index
+//is built in AudioPlayer.cc and handed back as an opaque table to free later
+void* buildMp3SeekIndex(ma_decoder* decoder);
+void freeMp3SeekIndex(void* table);
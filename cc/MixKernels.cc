@@ -0,0 +1,186 @@
+#include "MixKernels.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define EZAUDIO_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define EZAUDIO_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+static void mixAddScalar(float* dst, const float* src, size_t count, float gain) {
+	for(size_t i = 0; i < count; ++i) {
+		dst[i] += src[i] * gain;
+	}
+}
+
+#ifdef EZAUDIO_KERNELS_X86
+
+//sse2 is part of the x86_64 baseline so this is the floor on intel/amd
+static void mixAddSse2(float* dst, const float* src, size_t count, float gain) {
+	__m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		__m128 d = _mm_loadu_ps(dst + i);
+		__m128 s = _mm_loadu_ps(src + i);
+		_mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(s, g)));
+	}
+	mixAddScalar(dst + i, src + i, count - i, gain);
+}
+
+//compiled for avx2+fma regardless of build flags, only called after a cpuid check
+__attribute__((target("avx2,fma")))
+static void mixAddAvx2(float* dst, const float* src, size_t count, float gain) {
+	__m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		__m256 d = _mm256_loadu_ps(dst + i);
+		__m256 s = _mm256_loadu_ps(src + i);
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(s, g, d));
+	}
+	mixAddScalar(dst + i, src + i, count - i, gain);
+}
+
+#endif
+
+#ifdef EZAUDIO_KERNELS_NEON
+
+static void mixAddNeon(float* dst, const float* src, size_t count, float gain) {
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		float32x4_t d = vld1q_f32(dst + i);
+		float32x4_t s = vld1q_f32(src + i);
+		vst1q_f32(dst + i, vmlaq_n_f32(d, s, gain));
+	}
+	mixAddScalar(dst + i, src + i, count - i, gain);
+}
+
+#endif
+
+static void mixAddSelect(float* dst, const float* src, size_t count, float gain);
+
+static void (*mixAddImpl)(float*, const float*, size_t, float) = mixAddSelect;
+
+//first call resolves the widest kernel the cpu supports, after that every
+//call is a single indirect jump
+static void selectKernels() {
+#if defined(EZAUDIO_KERNELS_X86)
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		mixAddImpl = mixAddAvx2;
+	} else {
+		mixAddImpl = mixAddSse2;
+	}
+#elif defined(EZAUDIO_KERNELS_NEON)
+	mixAddImpl = mixAddNeon;
+#else
+	mixAddImpl = mixAddScalar;
+#endif
+}
+
+static void mixAddSelect(float* dst, const float* src, size_t count, float gain) {
+	selectKernels();
+	mixAddImpl(dst, src, count, gain);
+}
+
+void mixAdd(float* dst, const float* src, size_t count, float gain) {
+	mixAddImpl(dst, src, count, gain);
+}
+
+//the channel loop is the one branch in the per frame kernels the compiler
+//cannot hoist on its own, so they are templated on the channel count and
+//instantiated for mono and stereo, which covers nearly all real content,
+//straight line per frame code the compiler can unroll and schedule, the
+//runtime channel count versions stay as the fallback for exotic layouts
+
+template <size_t channelCount>
+static size_t mixAddResampleFixed(float* dst, const float* src, size_t srcFrames, size_t dstFrames, float gain, float gainStep, double step, double* pos) {
+	double p = *pos;
+	size_t wrote = 0;
+	while(wrote < dstFrames) {
+		size_t i0 = (size_t)p;
+		if(i0 + 1 >= srcFrames) {
+			break;
+		}
+		float t = (float)(p - (double)i0);
+		for(size_t channel = 0; channel < channelCount; ++channel) {
+			float a = src[i0 * channelCount + channel];
+			float b = src[(i0 + 1) * channelCount + channel];
+			dst[wrote * channelCount + channel] += (a + (b - a) * t) * gain;
+		}
+		gain += gainStep;
+		p += step;
+		++wrote;
+	}
+	*pos = p;
+	return wrote;
+}
+
+static size_t mixAddResampleAny(float* dst, const float* src, size_t srcFrames, size_t channels, size_t dstFrames, float gain, float gainStep, double step, double* pos) {
+	double p = *pos;
+	size_t wrote = 0;
+	while(wrote < dstFrames) {
+		size_t i0 = (size_t)p;
+		if(i0 + 1 >= srcFrames) {
+			break;
+		}
+		float t = (float)(p - (double)i0);
+		for(size_t channel = 0; channel < channels; ++channel) {
+			float a = src[i0 * channels + channel];
+			float b = src[(i0 + 1) * channels + channel];
+			dst[wrote * channels + channel] += (a + (b - a) * t) * gain;
+		}
+		gain += gainStep;
+		p += step;
+		++wrote;
+	}
+	*pos = p;
+	return wrote;
+}
+
+//one switch per block, the per frame loop inside is branch free
+size_t mixAddResample(float* dst, const float* src, size_t srcFrames, size_t channels, size_t dstFrames, float gain, float gainStep, double step, double* pos) {
+	switch(channels) {
+		case 1:
+			return mixAddResampleFixed<1>(dst, src, srcFrames, dstFrames, gain, gainStep, step, pos);
+		case 2:
+			return mixAddResampleFixed<2>(dst, src, srcFrames, dstFrames, gain, gainStep, step, pos);
+		default:
+			return mixAddResampleAny(dst, src, srcFrames, channels, dstFrames, gain, gainStep, step, pos);
+	}
+}
+
+template <size_t channelCount>
+static float mixAddRampFixed(float* dst, const float* src, size_t frames, float volume, float envelope, float step) {
+	for(size_t frame = 0; frame < frames; ++frame) {
+		float gain = volume * envelope;
+		for(size_t channel = 0; channel < channelCount; ++channel) {
+			size_t i = frame * channelCount + channel;
+			dst[i] += src[i] * gain;
+		}
+		envelope += step;
+	}
+	return envelope;
+}
+
+static float mixAddRampAny(float* dst, const float* src, size_t frames, size_t channels, float volume, float envelope, float step) {
+	for(size_t frame = 0; frame < frames; ++frame) {
+		float gain = volume * envelope;
+		for(size_t channel = 0; channel < channels; ++channel) {
+			size_t i = frame * channels + channel;
+			dst[i] += src[i] * gain;
+		}
+		envelope += step;
+	}
+	return envelope;
+}
+
+float mixAddRamp(float* dst, const float* src, size_t frames, size_t channels, float volume, float envelope, float step) {
+	switch(channels) {
+		case 1:
+			return mixAddRampFixed<1>(dst, src, frames, volume, envelope, step);
+		case 2:
+			return mixAddRampFixed<2>(dst, src, frames, volume, envelope, step);
+		default:
+			return mixAddRampAny(dst, src, frames, channels, volume, envelope, step);
+	}
+}
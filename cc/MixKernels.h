@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+//hot inner loops of the mixer, vectorized where the hardware allows with the
+//widest available kernel picked at runtime on first use
+
+//dst[i] += src[i] * gain
+void mixAdd(float* dst, const float* src, size_t count, float gain);
+
+//dst += src * volume * envelope, with the envelope stepped per frame, returns
+//the envelope after the last frame, scalar because ramps are short and rare
+float mixAddRamp(float* dst, const float* src, size_t frames, size_t channels, float volume, float envelope, float step);
+
+//linear interpolation resampler, reads src at *pos advancing step source
+//frames per output frame, gain advances by gainStep per output frame so fades
+//stay sample accurate through the resampler, stops when the next source frame
+//would run past srcFrames, returns output frames written and moves *pos
+size_t mixAddResample(float* dst, const float* src, size_t srcFrames, size_t channels, size_t dstFrames, float gain, float gainStep, double step, double* pos);
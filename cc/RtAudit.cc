@@ -0,0 +1,58 @@
+#include "RtAudit.h"
+
+#ifdef EZAUDIO_RT_AUDIT
+
+#include <cstdlib>
+#include <new>
+
+thread_local bool rtOnCallbackThread = false;
+std::atomic<size_t> rtViolations{0};
+
+//global interception so vector growth, string copies and anything else that
+//touches the heap on the callback thread is counted, wherever it came from,
+//syscalls cannot be hooked portably so blocking calls show up through the
+//locks and allocations they make instead
+static void* rtAlloc(std::size_t size) {
+	if(rtOnCallbackThread) {
+		rtViolations.fetch_add(1, std::memory_order_relaxed);
+	}
+	return std::malloc(size);
+}
+
+static void rtFree(void* ptr) {
+	if(rtOnCallbackThread) {
+		rtViolations.fetch_add(1, std::memory_order_relaxed);
+	}
+	std::free(ptr);
+}
+
+void* operator new(std::size_t size) {
+	void* ptr = rtAlloc(size);
+	if(ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void* operator new[](std::size_t size) {
+	void* ptr = rtAlloc(size);
+	if(ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept { rtFree(ptr); }
+void operator delete[](void* ptr) noexcept { rtFree(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { rtFree(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { rtFree(ptr); }
+
+#endif
+
+extern "C" size_t getRtViolations() {
+#ifdef EZAUDIO_RT_AUDIT
+	return rtViolations.load(std::memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
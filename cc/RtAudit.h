@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+//real time safety audit, built with EZAUDIO_RT_AUDIT (cargo feature rt-audit)
+//the engine counts heap allocations and lock acquisitions made on the audio
+//callback thread, so the wait free callback guarantee is checked by running
+//the app instead of by reading the code, production builds compile all of it
+//down to nothing
+
+#ifdef EZAUDIO_RT_AUDIT
+
+extern thread_local bool rtOnCallbackThread;
+extern std::atomic<size_t> rtViolations;
+
+//marks the audio callback thread for the duration of one block
+struct RtCallbackScope {
+	RtCallbackScope() { rtOnCallbackThread = true; }
+	~RtCallbackScope() { rtOnCallbackThread = false; }
+};
+
+//drop in for std::lock_guard that counts locks taken on the callback thread
+struct LockGuard {
+	std::lock_guard<std::mutex> guard;
+	explicit LockGuard(std::mutex& mtx) : guard(check(mtx)) {}
+
+	static std::mutex& check(std::mutex& mtx) {
+		if(rtOnCallbackThread) {
+			rtViolations.fetch_add(1, std::memory_order_relaxed);
+		}
+		return mtx;
+	}
+};
+
+#define RT_CALLBACK_SCOPE() RtCallbackScope rtCallbackScope
+
+#else
+
+using LockGuard = std::lock_guard<std::mutex>;
+#define RT_CALLBACK_SCOPE()
+
+#endif
+
+//total violations seen so far, always zero outside audit builds
+extern "C" size_t getRtViolations();
@@ -1,24 +1,286 @@
 #include "AudioInterface.h"
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
 
-using namespace std;
+//benchmark harness, build with the Makefile in this directory and run from
+//anywhere, the render benches drive data_callback directly so they measure
+//the mix path alone and run as fast as the cpu allows, the load and registry
+//benches go through the public interface with a real context (the null
+//backend keeps it headless). pass audio files as arguments to add per codec
+//load numbers for formats we cannot synthesize here:
+//  ./bench [file.mp3] [file.flac] [file.ogg] ...
+//the binary doubles as the offline asset bank producer:
+//  ./bench --pack out.bank file1 [file2 ...]
 
-int main(){
-    /*auto context = init();
-    if(context.result){
-        cout <<  "hello" << endl;
-        AudioDevice* device = new AudioDevice(getDefaultAudioDevice(&context));
-        load(1, &context, "../slam.mp3", device);
-        play(1, &context);
-        cout << getDuration(1, &context) << endl;
-        cout << sizeof(device->id) << endl;
-        cout << getDefaultAudioDevice(&context).name << endl;
-    }
+static double nowMs() {
+	return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double percentile(std::vector<double>& sorted, double p) {
+	if(sorted.empty()) {
+		return 0;
+	}
+	size_t index = (size_t)(p * (sorted.size() - 1));
+	return sorted[index];
+}
+
+//2 seconds of 48khz stereo s16 sine, enough for every wav based bench
+static bool writeWav(const char* path) {
+	const uint32_t sampleRate = 48000;
+	const uint16_t channels = 2;
+	const uint32_t frames = sampleRate * 2;
+	const uint32_t dataSize = frames * channels * 2;
+	std::ofstream file(path, std::ios::binary);
+	if(!file) {
+		return false;
+	}
+	uint32_t riffSize = 36 + dataSize;
+	uint32_t fmtSize = 16;
+	uint16_t format = 1; //pcm
+	uint32_t byteRate = sampleRate * channels * 2;
+	uint16_t blockAlign = channels * 2;
+	uint16_t bits = 16;
+	file.write("RIFF", 4);
+	file.write((char*)&riffSize, 4);
+	file.write("WAVE", 4);
+	file.write("fmt ", 4);
+	file.write((char*)&fmtSize, 4);
+	file.write((char*)&format, 2);
+	file.write((char*)&channels, 2);
+	file.write((char*)&sampleRate, 4);
+	file.write((char*)&byteRate, 4);
+	file.write((char*)&blockAlign, 2);
+	file.write((char*)&bits, 2);
+	file.write("data", 4);
+	file.write((char*)&dataSize, 4);
+	for(uint32_t i = 0; i < frames; ++i) {
+		int16_t sample = (int16_t)(std::sin(i * 0.05) * 16000);
+		file.write((char*)&sample, 2);
+		file.write((char*)&sample, 2);
+	}
+	return true;
+}
+
+//a bare OutputDevice plus synthetic voices, data_callback only touches the
+//channel count and pUserData on the device so no backend is needed
+struct RenderRig {
+	ma_device device;
+	OutputDevice out;
+	PcmBuffer buffer;
+	std::vector<SoundClip*> clips;
+
+	RenderRig(AudioContext* context, size_t voices, double step) {
+		std::memset(&device, 0, sizeof(device));
+		device.playback.channels = 2;
+		device.pUserData = &out;
+		out.context = context;
+		out.scratch.resize(8192 * 2);
+		out.clips.reserve(256);
+		out.commands.init(256);
+		out.stats.init();
+
+		buffer.channels = 2;
+		buffer.sampleRate = 48000;
+		buffer.frameCount = 48000 * 4;
+		buffer.frames.resize((size_t)buffer.frameCount * 2);
+		for(size_t i = 0; i < buffer.frames.size(); ++i) {
+			buffer.frames[i] = std::sin(i * 0.01f) * 0.1f;
+		}
+
+		for(size_t i = 0; i < voices; ++i) {
+			SoundClip* clip = new SoundClip{};
+			clip->buffer = &buffer;
+			clip->step = step;
+			clip->fadeGain = 1.0f;
+			clip->volume.store(0.5f, std::memory_order_relaxed);
+			clip->playing.store(true, std::memory_order_relaxed);
+			clip->context = context;
+			clip->output = &out;
+			out.clips.push_back(clip);
+			clips.push_back(clip);
+		}
+	}
+
+	~RenderRig() {
+		for(SoundClip* clip : clips) {
+			delete clip;
+		}
+	}
+
+	//rewinds every voice well before the end so no clip end event ever fires
+	void rewind() {
+		for(SoundClip* clip : clips) {
+			clip->cursor.store(0, std::memory_order_relaxed);
+			clip->srcPos = 0;
+		}
+	}
+};
+
+static void benchRenderThroughput(AudioContext* context) {
+	const ma_uint32 block = 480; //10ms at 48khz
+	const size_t iterations = 20000;
+	std::vector<float> output(block * 2);
+	for(double step : {1.0, 44100.0 / 48000.0}) {
+		RenderRig rig(context, 8, step);
+		double start = nowMs();
+		for(size_t i = 0; i < iterations; ++i) {
+			if(rig.clips[0]->cursor.load(std::memory_order_relaxed) + block * 2 > rig.buffer.frameCount) {
+				rig.rewind();
+			}
+			data_callback(&rig.device, output.data(), nullptr, block);
+		}
+		double elapsed = nowMs() - start;
+		double framesPerSec = iterations * (double)block / (elapsed / 1000.0);
+		std::cout << "render throughput (8 voices, step " << step << "): "
+			<< (uint64_t)framesPerSec << " frames/s, "
+			<< framesPerSec / 48000.0 << "x realtime" << std::endl;
+	}
+}
+
+static void benchVoiceScaling(AudioContext* context) {
+	const ma_uint32 block = 480;
+	const size_t iterations = 5000;
+	std::vector<float> output(block * 2);
+	std::cout << "voices vs callback time:" << std::endl;
+	for(size_t voices : {1, 2, 4, 8, 16, 32, 64, 128}) {
+		RenderRig rig(context, voices, 1.0);
+		double start = nowMs();
+		for(size_t i = 0; i < iterations; ++i) {
+			if(rig.clips[0]->cursor.load(std::memory_order_relaxed) + block * 2 > rig.buffer.frameCount) {
+				rig.rewind();
+			}
+			data_callback(&rig.device, output.data(), nullptr, block);
+		}
+		double elapsed = nowMs() - start;
+		std::cout << "  " << voices << " voices: "
+			<< elapsed / iterations * 1000.0 << " us/callback" << std::endl;
+	}
+}
+
+//loads go through loadFromMemory because path loads hit the shared pcm cache
+//after the first decode, memory loads get a private buffer so every iteration
+//pays the full decode and the numbers reflect the codec, not the cache
+static void benchLoadLatency(AudioContext* context, AudioDevice* device, const char* path) {
+	std::ifstream file(path, std::ios::binary);
+	if(!file) {
+		std::cout << "  " << path << ": could not open" << std::endl;
+		return;
+	}
+	std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	const size_t iterations = 50;
+	std::vector<double> times;
+	for(size_t i = 0; i < iterations; ++i) {
+		double start = nowMs();
+		if(loadFromMemory(1000 + i, context, bytes.data(), bytes.size(), device) != 0) {
+			std::cout << "  " << path << ": failed to load" << std::endl;
+			return;
+		}
+		times.push_back(nowMs() - start);
+		removeSound(1000 + i, context);
+	}
+	std::sort(times.begin(), times.end());
+	std::cout << "  " << path << ": min " << times.front()
+		<< "ms p50 " << percentile(times, 0.5)
+		<< "ms p99 " << percentile(times, 0.99) << "ms" << std::endl;
+}
+
+static void benchRegistryContention(AudioContext* context, AudioDevice* device, const char* path) {
+	const size_t readers = 4;
+	const size_t ids = 32;
+	for(size_t i = 0; i < ids; ++i) {
+		loadWithMode(2000 + i, context, path, device, 1);
+	}
+
+	//readers hammer the hot queries while the main thread churns loads and
+	//removals through the same registry, the numbers show whether the read
+	//path ever stalls behind the structural one
+	std::atomic<bool> stop{false};
+	std::atomic<uint64_t> reads{0};
+	std::vector<std::thread> threads;
+	for(size_t t = 0; t < readers; ++t) {
+		threads.emplace_back([&]() {
+			uint64_t local = 0;
+			while(!stop.load(std::memory_order_relaxed)) {
+				for(size_t i = 0; i < ids; ++i) {
+					isPlaying(2000 + i, context);
+					getVolume(2000 + i, context);
+					local += 2;
+				}
+			}
+			reads.fetch_add(local, std::memory_order_relaxed);
+		});
+	}
+
+	double start = nowMs();
+	size_t churn = 0;
+	while(nowMs() - start < 1000.0) {
+		//cycle a small id window, each id is removed before it comes around
+		//again and the churn stays inside the registry's paged range
+		loadWithMode(3000 + (churn & 1023), context, path, device, 1);
+		removeSound(3000 + (churn & 1023), context);
+		++churn;
+	}
+	double elapsed = nowMs() - start;
+	stop.store(true, std::memory_order_relaxed);
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
 
-    
+	std::cout << "registry contention (" << readers << " readers vs load/remove churn): "
+		<< (uint64_t)(reads.load(std::memory_order_relaxed) / (elapsed / 1000.0)) << " reads/s, "
+		<< (uint64_t)(churn / (elapsed / 1000.0)) << " load+remove/s" << std::endl;
 
-    getchar();
-    uninit(&context);*/
+	for(size_t i = 0; i < ids; ++i) {
+		removeSound(2000 + i, context);
+	}
 }
 
+static void nullEndCallback(void*) {}
 
+int main(int argc, char** argv) {
+	//offline asset bank producer: ./bench --pack out.bank file1 [file2 ...]
+	if(argc > 3 && std::strcmp(argv[1], "--pack") == 0) {
+		if(writeBank(argv[2], (const char* const*)(argv + 3), argc - 3, 2) != 0) {
+			std::cout << "failed to write " << argv[2] << std::endl;
+			return 1;
+		}
+		std::cout << "packed " << argc - 3 << " clips into " << argv[2] << std::endl;
+		return 0;
+	}
+
+	AudioContext context = init(nullEndCallback);
+	if(!context.result) {
+		std::cout << "context init failed, no backend at all" << std::endl;
+		return 1;
+	}
+
+	benchRenderThroughput(&context);
+	benchVoiceScaling(&context);
+
+	AudioDevice device = getDefaultAudioDevice(&context);
+	const char* wavPath = "bench.wav";
+	if(!writeWav(wavPath)) {
+		std::cout << "could not write " << wavPath << std::endl;
+		uninit(&context);
+		return 1;
+	}
+
+	std::cout << "decode latency (full preload decode, 50 iterations):" << std::endl;
+	benchLoadLatency(&context, &device, wavPath);
+	for(int i = 1; i < argc; ++i) {
+		benchLoadLatency(&context, &device, argv[i]);
+	}
+
+	benchRegistryContention(&context, &device, wavPath);
+
+	std::remove(wavPath);
+	uninit(&context);
+}
@@ -26,10 +26,12 @@
 //! ```
 #![feature(fn_traits)]
 #![feature(unboxed_closures)]
+#![feature(tuple_trait)]
 #![feature(get_mut_unchecked)]
 #![warn(missing_docs)]
 
 use std::ffi::{CStr, CString, OsStr};
+use std::os::raw::c_void;
 use std::fs::metadata;
 use std::iter::Iterator;
 use std::os::raw::c_char;
@@ -60,7 +62,16 @@ struct AudioContext {
     context: usize,     //pointer not real usize
     sound_clips: usize, //pointer not real usize
     result: bool,
-    mtx: usize, //pointer not real usize
+    mtx: usize,       //pointer not real usize
+    outputs: usize,   //pointer not real usize
+    cache: usize,     //pointer not real usize
+    cache_mtx: usize, //pointer not real usize
+    worker: usize,    //pointer not real usize
+    loader: usize,    //pointer not real usize
+    pool: usize,      //pointer not real usize
+    devices: usize,   //pointer not real usize
+    stream_threshold: usize,
+    cache_budget: usize,
 }
 
 #[allow(improper_ctypes)]
@@ -68,25 +79,70 @@ extern "C" {
     fn init(end_callback: unsafe extern "C" fn(*mut InnerHandle<()>)) -> AudioContext;
     fn uninit(context: *const AudioContext);
 
-    fn load(
+    fn loadWithMode(
         id: usize,
         context: *const AudioContext,
         path: *const c_char,
         device: *const AudioDevice,
+        mode: i32,
     ) -> i32;
+    fn setPreloadThreshold(context: *const AudioContext, bytes: usize);
+    fn loadFromMemory(
+        id: usize,
+        context: *const AudioContext,
+        data: *const u8,
+        len: usize,
+        device: *const AudioDevice,
+    ) -> i32;
+    fn loadBatch(
+        ids: *const usize,
+        paths: *const *const c_char,
+        count: usize,
+        context: *const AudioContext,
+        device: *const AudioDevice,
+        results: *mut i32,
+    );
+    fn loadAsync(
+        id: usize,
+        context: *const AudioContext,
+        path: *const c_char,
+        device: *const AudioDevice,
+        callback: unsafe extern "C" fn(*mut c_void, i32),
+        user: *mut c_void,
+    );
+    fn playOneShot(
+        context: *const AudioContext,
+        path: *const c_char,
+        device: *const AudioDevice,
+        volume: f32,
+    );
+    fn queueNext(id: usize, next: usize, context: *const AudioContext);
     fn setOuter(id: usize, context: *const AudioContext, outer: *const InnerHandle<()>);
     fn removeSound(id: usize, context: *const AudioContext);
 
     fn play(id: usize, context: *const AudioContext);
     fn stop(id: usize, context: *const AudioContext);
+    fn fadeIn(id: usize, context: *const AudioContext, ms: u64);
+    fn fadeOut(id: usize, context: *const AudioContext, ms: u64);
+    fn crossfadeTo(id: usize, other: usize, context: *const AudioContext, ms: u64);
+    fn setPlaybackRate(id: usize, context: *const AudioContext, rate: f32);
+    fn renderOffline(
+        id: usize,
+        context: *const AudioContext,
+        buffer: *mut f32,
+        frames: u64,
+    ) -> u64;
     fn reset(id: usize, context: *const AudioContext);
     fn setVolume(id: usize, context: *const AudioContext, value: f32);
     fn getVolume(id: usize, context: *const AudioContext) -> f32;
 
     fn isPlaying(id: usize, context: *const AudioContext) -> bool;
     fn getDuration(id: usize, context: *const AudioContext) -> u64;
+    fn getCursorMs(id: usize, context: *const AudioContext) -> u64;
+    fn seekMs(id: usize, context: *const AudioContext, ms: u64);
 
     fn getDefaultAudioDevice(context: *const AudioContext) -> AudioDevice;
+    fn refreshAudioDevices(context: *const AudioContext);
     fn getAudioDevices(
         context: *const AudioContext,
         devices: *const AudioDevice,
@@ -94,6 +150,69 @@ extern "C" {
     ) -> usize;
     fn getAudioDeviceCount(context: &AudioContext) -> usize;
     fn setAudioDevice(id: usize, context: *const AudioContext, device: *const AudioDevice);
+    fn setAudioDeviceAll(context: *const AudioContext, device: *const AudioDevice);
+
+    fn getRtViolations() -> usize;
+
+    fn getStats(context: *const AudioContext, stats: *mut EngineStats);
+
+    fn setTraceEnabled(enabled: bool);
+    fn drainTrace(events: *mut TraceEvent, capacity: usize) -> usize;
+
+    fn setCacheBudget(context: *const AudioContext, bytes: usize);
+    fn getCacheMemoryUsage(context: *const AudioContext) -> usize;
+
+    fn openBank(path: *const c_char) -> usize;
+    fn closeBank(bank: usize);
+    fn getBankClipCount(bank: usize) -> usize;
+    fn loadFromBank(
+        id: usize,
+        context: *const AudioContext,
+        bank: usize,
+        clip_index: usize,
+        device: *const AudioDevice,
+    ) -> i32;
+}
+
+/// A snapshot of the engine's performance counters, aggregated over every
+/// open output device. Cheap to read, the audio callbacks only ever touch the
+/// counters with relaxed atomics.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct EngineStats {
+    /// Total audio callbacks run so far.
+    pub callbacks: u64,
+    /// Total frames mixed so far.
+    pub frames_rendered: u64,
+    /// Times a streaming voice's ring buffer ran dry mid file.
+    pub underruns: u64,
+    /// Shortest callback so far in microseconds.
+    pub min_callback_us: u64,
+    /// Longest callback so far in microseconds.
+    pub max_callback_us: u64,
+    /// 99th percentile callback duration in microseconds, estimated from a
+    /// log2 histogram so it is an upper bound.
+    pub p99_callback_us: u64,
+    /// Voices that were audible during the most recent callback.
+    pub active_voices: u32,
+    /// Voices currently streaming from disk.
+    pub streaming_voices: u32,
+    /// Lowest streaming ring buffer fill level right now, 0..1, 1.0 when
+    /// nothing is streaming.
+    pub min_ring_fill: f32,
+}
+
+/// How a clip gets its audio data.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum LoadMode {
+    /// Pick by file size: small files are decoded up front, big ones stream.
+    Auto,
+    /// Decode the whole file at load and drop the decoder and file handle
+    /// immediately, playback is pure memory reads.
+    Preload,
+    /// Keep a decoder feeding a ring buffer from a background thread, constant
+    /// memory no matter how long the file is.
+    Stream,
 }
 
 /// A general purpose error.
@@ -158,6 +277,24 @@ impl<'a> Device {
     }
 }
 
+/// Moves every clip in the context to `device` in one pass. Clips are rerouted
+/// between mixer callbacks without tearing the devices down, so nothing loses
+/// its playback position and the swap is inaudible.
+pub fn set_output_device_all(context: Context, device: &Device) {
+    unsafe {
+        setAudioDeviceAll(&context.inner.context, &device.device);
+    }
+}
+
+/// Forces a re-enumeration of the playback devices. Device queries read a
+/// cached snapshot that refreshes itself every couple of seconds; call this to
+/// pick up a newly plugged in device immediately.
+pub fn refresh_output_devices(context: Context) {
+    unsafe {
+        refreshAudioDevices(&context.inner.context);
+    }
+}
+
 /// Yields an iterator over all audio playback devices.
 pub fn output_devices(context: Context) -> Devices {
     unsafe {
@@ -228,6 +365,126 @@ impl Context {
     }
 }
 
+impl Context {
+    /// Sets the file size at which [`LoadMode::Auto`] switches from decoding
+    /// up front to streaming. Only affects loads made after the call.
+    pub fn set_preload_threshold(&self, bytes: usize) {
+        unsafe {
+            setPreloadThreshold(&self.inner.context, bytes);
+        }
+    }
+
+    /// Caps the memory the decoded-audio cache may hold, in bytes; 0 (the
+    /// default) lifts the cap. When the budget is exceeded the least recently
+    /// used buffers not referenced by any live clip are evicted, so their
+    /// next load decodes again; buffers in use are never evicted, and once
+    /// the budget is exhausted by live clips, further [`LoadMode::Auto`]
+    /// loads stream instead of growing the cache.
+    pub fn set_cache_budget(&self, bytes: usize) {
+        unsafe {
+            setCacheBudget(&self.inner.context, bytes);
+        }
+    }
+
+    /// Bytes of decoded audio currently held by the cache.
+    pub fn cache_memory_usage(&self) -> usize {
+        unsafe { getCacheMemoryUsage(&self.inner.context) }
+    }
+
+    /// Returns a snapshot of the engine's performance counters, see
+    /// [`EngineStats`]. Safe to poll from a dashboard at any rate.
+    pub fn stats(&self) -> EngineStats {
+        let mut stats = EngineStats::default();
+        unsafe {
+            getStats(&self.inner.context, &mut stats);
+        }
+        stats
+    }
+}
+
+/// Number of real time safety violations (heap allocations or lock
+/// acquisitions on the audio callback thread) seen so far. Always zero unless
+/// the crate was built with the `rt-audit` feature, which installs the
+/// counting hooks.
+pub fn rt_violations() -> usize {
+    unsafe { getRtViolations() }
+}
+
+/// One timestamped event from the engine's trace ring, see [`drain_trace`].
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct TraceEvent {
+    /// Monotonic clock microseconds.
+    pub time_us: u64,
+    /// Event specific payload: frames for callback/decode events, the command
+    /// kind for command events, the clip id for end-of-clip events.
+    pub arg: u64,
+    /// 0 callback enter, 1 callback exit, 2 decode start, 3 decode end,
+    /// 4 command dequeued, 5 clip ended.
+    pub kind: u32,
+    /// Small per thread ordinal, stable for the life of the thread.
+    pub thread: u32,
+}
+
+/// Turns hot path event tracing on or off. Off (the default) costs the audio
+/// thread a single predicted branch per event site; on, events go into a
+/// fixed size lock free ring that [`drain_trace`] empties.
+pub fn set_trace_enabled(enabled: bool) {
+    unsafe { setTraceEnabled(enabled) }
+}
+
+/// Drains every buffered trace event, oldest first. The ring holds 16384
+/// events; drain faster than the engine produces them or the oldest are
+/// overwritten.
+pub fn drain_trace() -> Vec<TraceEvent> {
+    let mut events = Vec::new();
+    let mut chunk = [TraceEvent {
+        time_us: 0,
+        arg: 0,
+        kind: 0,
+        thread: 0,
+    }; 1024];
+    loop {
+        let count = unsafe { drainTrace(chunk.as_mut_ptr(), chunk.len()) };
+        events.extend_from_slice(&chunk[..count]);
+        if count < chunk.len() {
+            return events;
+        }
+    }
+}
+
+/// Converts trace events into chrome://tracing JSON (the "trace event
+/// format"), ready to save to a file and open in the tracing viewer or
+/// [Perfetto](https://ui.perfetto.dev). Callback and decode events become
+/// begin/end pairs, the rest become instant events.
+pub fn trace_to_chrome_json(events: &[TraceEvent]) -> String {
+    let mut json = String::from("{\"traceEvents\":[");
+    for (i, event) in events.iter().enumerate() {
+        if i > 0 {
+            json.push(',');
+        }
+        let (name, ph) = match event.kind {
+            0 => ("callback", "B"),
+            1 => ("callback", "E"),
+            2 => ("decode", "B"),
+            3 => ("decode", "E"),
+            4 => ("command", "i"),
+            _ => ("clipEnd", "i"),
+        };
+        json.push_str(&format!(
+            "{{\"name\":\"{}\",\"ph\":\"{}\",\"ts\":{},\"pid\":1,\"tid\":{},\"args\":{{\"arg\":{}}}{}}}",
+            name,
+            ph,
+            event.time_us,
+            event.thread,
+            event.arg,
+            if ph == "i" { ",\"s\":\"t\"" } else { "" }
+        ));
+    }
+    json.push_str("]}");
+    json
+}
+
 impl Drop for InnerContext {
     fn drop(&mut self) {
         unsafe {
@@ -239,9 +496,11 @@ impl Drop for InnerContext {
 /// A builder that loads an audio file into memory and returns an audio playback handle.
 pub struct AudioLoader<'a, T, I, P> {
     path: P,
+    data: Option<&'static [u8]>,
     context: Context,
     device: Option<&'a Device>,
     volume: f32,
+    mode: LoadMode,
     on_end: Option<I>,
     user_data: T,
 }
@@ -254,9 +513,32 @@ where
     pub fn new(path: P, context: Context) -> AudioLoader<'a, (), void::Void, P> {
         AudioLoader {
             path,
+            data: None,
             context,
             device: None,
             volume: 1f32,
+            mode: LoadMode::Auto,
+            on_end: None,
+            user_data: (),
+        }
+    }
+}
+
+impl<'a> AudioLoader<'a, (), void::Void, &'static str> {
+    /// Creates an audio loader that plays audio already in memory, such as assets
+    /// embedded in the binary with `include_bytes!`. The data is borrowed by the
+    /// backend without copying, which is why it must be `'static`.
+    pub fn new_from_memory(
+        data: &'static [u8],
+        context: Context,
+    ) -> AudioLoader<'a, (), void::Void, &'static str> {
+        AudioLoader {
+            path: "",
+            data: Some(data),
+            context,
+            device: None,
+            volume: 1f32,
+            mode: LoadMode::Auto,
             on_end: None,
             user_data: (),
         }
@@ -286,26 +568,50 @@ where
         self
     }
 
+    /// Set whether the clip is decoded up front or streamed, see [`LoadMode`].
+    /// Only applies to file loads, in memory data needs no file handle.
+    pub fn mode(mut self, mode: LoadMode) -> Self {
+        self.mode = mode;
+        self
+    }
+
     /// Destroys loader and returns a audio handle
     pub fn load(self) -> Result<AudioHandle<T>, AudioError> {
-        if metadata(self.path.as_ref()).is_err() {
+        if self.data.is_none() && metadata(self.path.as_ref()).is_err() {
             return Err(AudioError::FileError);
         };
 
         unsafe {
             let id = get_id();
-            let result = load(
-                id,
-                &self.context.inner.context,
-                #[allow(temporary_cstring_as_ptr)]
-                CString::new(self.path.as_ref().as_os_str().to_str().unwrap())
-                    .unwrap()
-                    .as_ptr(),
-                &self
-                    .device
-                    .unwrap_or(&default_output_device(self.context.clone()))
-                    .device,
-            );
+            let default_device;
+            let device = match self.device {
+                Some(device) => device,
+                None => {
+                    default_device = default_output_device(self.context.clone());
+                    &default_device
+                }
+            };
+            let device = &device.device as *const AudioDevice;
+            let result = if let Some(data) = self.data {
+                loadFromMemory(
+                    id,
+                    &self.context.inner.context,
+                    data.as_ptr(),
+                    data.len(),
+                    device,
+                )
+            } else {
+                loadWithMode(
+                    id,
+                    &self.context.inner.context,
+                    #[allow(temporary_cstring_as_ptr)]
+                    CString::new(self.path.as_ref().as_os_str().to_str().unwrap())
+                        .unwrap()
+                        .as_ptr(),
+                    device,
+                    self.mode as i32,
+                )
+            };
 
             let res = match result {
                 0 => Ok(AudioHandle {
@@ -340,14 +646,101 @@ where
     }
 }
 
+unsafe extern "C" fn load_trampoline<T, F>(user: *mut c_void, result: i32)
+where
+    F: FnOnce(Result<AudioHandle<T>, AudioError>) + Send + 'static,
+{
+    let (on_load, inner, context) = *Box::from_raw(user as *mut (F, Arc<InnerHandle<T>>, Context));
+    let res = match result {
+        0 => {
+            setOuter(
+                inner.id,
+                &context.inner.context,
+                Arc::as_ptr(&inner) as *const InnerHandle<()>,
+            );
+            Ok(AudioHandle { inner })
+        }
+        -1 => Err(AudioError::DecoderError),
+        -2 => Err(AudioError::DeviceError),
+        _ => Err(AudioError::UnknownError),
+    };
+    on_load(res);
+}
+
+impl<'a, T, I, P> AudioLoader<'a, T, I, P>
+where
+    P: AsRef<Path>,
+    I: 'static + FnMut(&mut T) + Send,
+    T: Send + 'static,
+{
+    /// Non-blocking variant of [`AudioLoader::load`]: returns immediately and
+    /// runs `on_load` with the result on the context's loader thread once the
+    /// clip is ready, so a cold disk never stalls the calling thread.
+    pub fn load_async<F>(self, on_load: F)
+    where
+        F: FnOnce(Result<AudioHandle<T>, AudioError>) + Send + 'static,
+    {
+        //in memory data needs no disk io, nothing to win by deferring it
+        if self.data.is_some() {
+            on_load(self.load());
+            return;
+        }
+        if metadata(self.path.as_ref()).is_err() {
+            on_load(Err(AudioError::FileError));
+            return;
+        }
+
+        unsafe {
+            let id = get_id();
+            let inner = Arc::new(InnerHandle {
+                id,
+                path: self.path.as_ref().to_path_buf(),
+                context: self.context.clone(),
+                user_data: RwLock::new(Arc::new(self.user_data)),
+                on_end: {
+                    if let Some(on_end) = self.on_end {
+                        Some(Mutex::new(Box::new(on_end)
+                            as Box<dyn FnMut(&mut T) + Send>))
+                    } else {
+                        None
+                    }
+                },
+            });
+
+            let default_device;
+            let device = match self.device {
+                Some(device) => device,
+                None => {
+                    default_device = default_output_device(self.context.clone());
+                    &default_device
+                }
+            };
+
+            let user = Box::into_raw(Box::new((on_load, inner, self.context.clone()))) as *mut c_void;
+            let path = CString::new(self.path.as_ref().as_os_str().to_str().unwrap()).unwrap();
+            //the backend copies the path and device before returning
+            loadAsync(
+                id,
+                &self.context.inner.context,
+                path.as_ptr(),
+                &device.device,
+                load_trampoline::<T, F>,
+                user,
+            );
+        }
+    }
+}
+
 impl<'a, T, I, P0> AudioLoader<'a, T, I, P0> {
     /// Set path to file.
     pub fn path<P1: AsRef<Path>>(self, path: P1) -> AudioLoader<'a, T, I, P1> {
         AudioLoader {
             path,
+            data: self.data,
             context: self.context,
             device: self.device,
             volume: self.volume,
+            mode: self.mode,
             on_end: self.on_end,
             user_data: self.user_data,
         }
@@ -359,9 +752,11 @@ impl<'a, T0, I, P> AudioLoader<'a, T0, I, P> {
     pub fn user_data<T1>(self, user_data: T1) -> AudioLoader<'a, T1, I, P> {
         AudioLoader {
             path: self.path,
+            data: self.data,
             context: self.context,
             device: self.device,
             volume: self.volume,
+            mode: self.mode,
             on_end: self.on_end,
             user_data,
         }
@@ -373,15 +768,208 @@ impl<'a, T, F0: Fn(T), P> AudioLoader<'a, T, F0, P> {
     pub fn on_end<F1: FnMut(&mut T) + Send>(self, on_end: F1) -> AudioLoader<'a, T, F1, P> {
         AudioLoader {
             path: self.path,
+            data: self.data,
             context: self.context,
             device: self.device,
             volume: self.volume,
+            mode: self.mode,
             on_end: Some(on_end),
             user_data: self.user_data,
         }
     }
 }
 
+/// Loads many files at once, fanning decoding out across all cores and
+/// registering every clip in one pass. Much faster than calling
+/// [`AudioLoader::load`] in a loop for big asset sets; results come back in
+/// the same order as `paths`.
+pub fn load_batch<P: AsRef<Path>>(
+    paths: &[P],
+    context: Context,
+    device: Option<&Device>,
+) -> Vec<Result<AudioHandle<()>, AudioError>> {
+    unsafe {
+        let default_device;
+        let device = match device {
+            Some(device) => device,
+            None => {
+                default_device = default_output_device(context.clone());
+                &default_device
+            }
+        };
+
+        let ids: Vec<usize> = paths.iter().map(|_| get_id()).collect();
+        let cstrings: Vec<CString> = paths
+            .iter()
+            .map(|path| CString::new(path.as_ref().as_os_str().to_str().unwrap()).unwrap())
+            .collect();
+        let pointers: Vec<*const c_char> = cstrings.iter().map(|path| path.as_ptr()).collect();
+        let mut results = vec![0i32; paths.len()];
+
+        loadBatch(
+            ids.as_ptr(),
+            pointers.as_ptr(),
+            paths.len(),
+            &context.inner.context,
+            &device.device,
+            results.as_mut_ptr(),
+        );
+
+        paths
+            .iter()
+            .zip(ids)
+            .zip(results)
+            .map(|((path, id), result)| match result {
+                0 => {
+                    let handle = AudioHandle {
+                        inner: Arc::new(InnerHandle {
+                            id,
+                            path: path.as_ref().to_path_buf(),
+                            context: context.clone(),
+                            user_data: RwLock::new(Arc::new(())),
+                            on_end: None,
+                        }),
+                    };
+                    setOuter(
+                        id,
+                        &context.inner.context,
+                        Arc::as_ptr(&handle.inner) as *const InnerHandle<()>,
+                    );
+                    Ok(handle)
+                }
+                -1 if metadata(path.as_ref()).is_err() => Err(AudioError::FileError),
+                -1 => Err(AudioError::DecoderError),
+                -2 => Err(AudioError::DeviceError),
+                _ => Err(AudioError::UnknownError),
+            })
+            .collect()
+    }
+}
+
+/// A pre-decoded PCM asset bank, produced offline by the `--pack` mode of the
+/// tool in `cc/`. Opening one costs a single mmap; clips loaded from it play
+/// straight out of the mapping with no decode and no copy, and the pages are
+/// shared between processes using the same bank.
+pub struct Bank {
+    bank: usize,
+    path: PathBuf,
+}
+
+unsafe impl Send for Bank {}
+unsafe impl Sync for Bank {}
+
+impl Bank {
+    /// Opens and validates a bank file.
+    pub fn open<P: AsRef<Path>>(path: P) -> Result<Bank, AudioError> {
+        let cstring = CString::new(path.as_ref().as_os_str().to_str().unwrap()).unwrap();
+        let bank = unsafe { openBank(cstring.as_ptr()) };
+        if bank == 0 {
+            Err(AudioError::FileError)
+        } else {
+            Ok(Bank {
+                bank,
+                path: path.as_ref().to_path_buf(),
+            })
+        }
+    }
+
+    /// Number of clips packed into the bank.
+    pub fn clip_count(&self) -> usize {
+        unsafe { getBankClipCount(self.bank) }
+    }
+
+    /// Loads clip `index` from the bank, zero decode and zero copy.
+    ///
+    /// The bank must outlive every handle loaded from it; the clip's samples
+    /// live in the mapping, so drop all handles before dropping the bank.
+    pub fn load(
+        &self,
+        index: usize,
+        context: Context,
+        device: Option<&Device>,
+    ) -> Result<AudioHandle<()>, AudioError> {
+        unsafe {
+            let default_device;
+            let device = match device {
+                Some(device) => device,
+                None => {
+                    default_device = default_output_device(context.clone());
+                    &default_device
+                }
+            };
+            let id = get_id();
+            let result = loadFromBank(id, &context.inner.context, self.bank, index, &device.device);
+            match result {
+                0 => {
+                    let handle = AudioHandle {
+                        inner: Arc::new(InnerHandle {
+                            id,
+                            path: self.path.clone(),
+                            context: context.clone(),
+                            user_data: RwLock::new(Arc::new(())),
+                            on_end: None,
+                        }),
+                    };
+                    setOuter(
+                        id,
+                        &context.inner.context,
+                        Arc::as_ptr(&handle.inner) as *const InnerHandle<()>,
+                    );
+                    Ok(handle)
+                }
+                -1 => Err(AudioError::DecoderError),
+                -2 => Err(AudioError::DeviceError),
+                _ => Err(AudioError::UnknownError),
+            }
+        }
+    }
+}
+
+impl Drop for Bank {
+    fn drop(&mut self) {
+        unsafe {
+            closeBank(self.bank);
+        }
+    }
+}
+
+/// Fire-and-forget playback for short sound effects. Starts playing right
+/// away and returns no handle; the backend recycles the voice the moment the
+/// clip ends. The decoded audio is cached, so replaying the same file is free
+/// of decoding and allocation.
+pub fn play_one_shot<P: AsRef<Path>>(
+    path: P,
+    context: Context,
+    device: Option<&Device>,
+    volume: f32,
+) -> Result<(), AudioError> {
+    if metadata(path.as_ref()).is_err() {
+        return Err(AudioError::FileError);
+    }
+
+    unsafe {
+        let default_device;
+        let device = match device {
+            Some(device) => device,
+            None => {
+                default_device = default_output_device(context.clone());
+                &default_device
+            }
+        };
+
+        playOneShot(
+            &context.inner.context,
+            #[allow(temporary_cstring_as_ptr)]
+            CString::new(path.as_ref().as_os_str().to_str().unwrap())
+                .unwrap()
+                .as_ptr(),
+            &device.device,
+            volume,
+        );
+    }
+    Ok(())
+}
+
 struct InnerHandle<T> {
     id: usize,
     path: PathBuf,
@@ -423,6 +1011,70 @@ impl<T> AudioHandle<T> {
         }
     }
 
+    /// Starts playback with the volume ramping up from silence over `duration`.
+    /// The ramp is evaluated per sample by the mixer, so it is click free.
+    pub fn fade_in(&self, duration: Duration) {
+        unsafe {
+            fadeIn(
+                self.inner.id,
+                &self.inner.context.inner.context,
+                duration.as_millis() as u64,
+            );
+        }
+    }
+
+    /// Ramps the volume down to silence over `duration` and pauses playback at
+    /// the exact end of the ramp.
+    pub fn fade_out(&self, duration: Duration) {
+        unsafe {
+            fadeOut(
+                self.inner.id,
+                &self.inner.context.inner.context,
+                duration.as_millis() as u64,
+            );
+        }
+    }
+
+    /// Fades this handle out while fading `other` in over the same window.
+    pub fn crossfade_to<U>(&self, other: &AudioHandle<U>, duration: Duration) {
+        unsafe {
+            crossfadeTo(
+                self.inner.id,
+                other.inner.id,
+                &self.inner.context.inner.context,
+                duration.as_millis() as u64,
+            );
+        }
+    }
+
+    /// Sets the playback rate, changing pitch and speed together; 1.0 is
+    /// normal, 2.0 plays an octave up at double speed. Applied in the mixer's
+    /// resampling stage so one asset serves every pitch variant. Has no
+    /// effect on streaming clips; non-positive rates are ignored.
+    pub fn set_playback_rate(&self, rate: f32) {
+        unsafe {
+            setPlaybackRate(self.inner.id, &self.inner.context.inner.context, rate);
+        }
+    }
+
+    /// Renders the clip into `buffer` at CPU speed instead of wall-clock
+    /// speed, through the same mixer pipeline as live playback — volume,
+    /// fades and playback rate all apply. Useful for mixdown export, loudness
+    /// analysis and waveform previews. `buffer` is interleaved stereo, so it
+    /// holds `buffer.len() / 2` frames; returns the number of frames pumped,
+    /// which is short when the clip ends first. The clip must be stopped, and
+    /// rendering starts from the current position.
+    pub fn render_offline(&self, buffer: &mut [f32]) -> u64 {
+        unsafe {
+            renderOffline(
+                self.inner.id,
+                &self.inner.context.inner.context,
+                buffer.as_mut_ptr(),
+                (buffer.len() / 2) as u64,
+            )
+        }
+    }
+
     /// Resets to start of audio clip.
     pub fn reset(&self) {
         unsafe {
@@ -477,6 +1129,42 @@ impl<T> AudioHandle<T> {
         }
     }
 
+    /// Queues `next` to start the moment this handle reaches its final frame.
+    /// The mixer splices the transition inside a single callback, so there is
+    /// no gap between tracks. The on end closure still fires for this handle.
+    /// Both handles must stay alive until the transition has happened.
+    pub fn queue_next<U>(&self, next: &AudioHandle<U>) {
+        unsafe {
+            queueNext(
+                self.inner.id,
+                next.inner.id,
+                &self.inner.context.inner.context,
+            );
+        }
+    }
+
+    /// Returns the current playback position. Reads a frame counter kept by
+    /// the mixer, so calling this every frame for a progress bar is free.
+    pub fn position(&self) -> Duration {
+        unsafe {
+            Duration::from_millis(getCursorMs(
+                self.inner.id,
+                &self.inner.context.inner.context,
+            ))
+        }
+    }
+
+    /// Seeks to the given position.
+    pub fn seek(&self, position: Duration) {
+        unsafe {
+            seekMs(
+                self.inner.id,
+                &self.inner.context.inner.context,
+                position.as_millis() as u64,
+            );
+        }
+    }
+
     /// Sets playback device
     pub fn set_output_device(&self, device: &Device) {
         unsafe {
@@ -1,6 +1,8 @@
+use std::marker::Tuple;
+
 pub enum Void {}
 
-impl<T> FnOnce<T> for Void {
+impl<T: Tuple> FnOnce<T> for Void {
     type Output = ();
 
     extern "rust-call" fn call_once(self, _args: T) {
@@ -8,13 +10,13 @@ impl<T> FnOnce<T> for Void {
     }
 }
 
-impl<T> FnMut<T> for Void {
+impl<T: Tuple> FnMut<T> for Void {
     extern "rust-call" fn call_mut(&mut self, _args: T) {
         match *self {}
     }
 }
 
-impl<T> Fn<T> for Void {
+impl<T: Tuple> Fn<T> for Void {
     extern "rust-call" fn call(&self, _args: T) {
         match *self {}
     }